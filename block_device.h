@@ -0,0 +1,63 @@
+#ifndef BLOCK_DEVICE_H
+#define BLOCK_DEVICE_H
+
+#include <stdint.h>
+
+/**
+ * Every medium that the SCSI layer can sit on top of is described by one of these. All transfers
+ * are whole logical blocks; the SCSI layer takes care of chopping them up into endpoint-sized
+ * pieces.
+ *
+ * read and write return 0 on success and nonzero if the medium couldn't complete the transfer.
+ * Read-only media leave write set to 0.
+ *
+ * optimal_blocks is the medium's natural unit of transfer in blocks: its erase size, or the
+ * cluster size of the filesystem it was formatted with. The host is asked to size and align its
+ * transfers to it. 0 is treated as 1.
+ *
+ * The remaining hooks are optional and may be left 0:
+ *   revert   throws away everything that's been written and goes back to the medium's original
+ *            contents.
+ *   unmap    tells the medium that the host no longer cares about count blocks starting at lba.
+ *            Until they're written again, they have to read back as zeros.
+ *
+ * There are no flush or power hooks: every medium here finishes a write before returning from it
+ * and lives in SRAM or internal flash, so there's never anything to write back or a backend to
+ * power down when the host stops the unit.
+ */
+#define BLOCK_DEVICE_BLOCK_SHIFT 9
+#define BLOCK_DEVICE_BLOCK_SIZE (1 << BLOCK_DEVICE_BLOCK_SHIFT)
+
+typedef struct block_device block_device_t;
+
+/**
+ * Returns nonzero if a block is all zeros. buf must be word aligned. Goes a word at a time and
+ * gives up at the first 16 bytes with anything in them, so non-zero data is rejected almost
+ * immediately.
+ */
+static inline int block_device_is_zero(const uint8_t *buf)
+{
+    const uint32_t *p = (const uint32_t *)buf;
+    const uint32_t *const end = p + (BLOCK_DEVICE_BLOCK_SIZE / 4);
+    for (; p < end; p += 4) {
+        if (p[0] | p[1] | p[2] | p[3]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+struct block_device
+{
+    void *ctx;
+    uint32_t block_count;
+    uint16_t optimal_blocks;
+
+    int (*read)(const block_device_t *dev, uint32_t lba, uint8_t *buf);
+    int (*write)(const block_device_t *dev, uint32_t lba, const uint8_t *buf);
+
+    int (*revert)(const block_device_t *dev);
+    int (*unmap)(const block_device_t *dev, uint32_t lba, uint32_t count);
+};
+
+#endif
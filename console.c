@@ -0,0 +1,132 @@
+#include "console.h"
+
+#include "samd21.h"
+
+#include "interrupt_utils.h"
+#include "stack.h"
+#include "stats.h"
+#include "trace.h"
+
+#include <string.h>
+
+static ring_buffer_t *console_rx;
+
+static char console_line[CONSOLE_LINE_MAX + 1];
+static uint32_t console_len;
+static int console_overflow;
+
+static const char *const console_levels[] = { "debug", "info", "error" };
+
+void console_init(ring_buffer_t *rx)
+{
+    console_rx = rx;
+    console_len = 0;
+    console_overflow = 0;
+}
+
+int console_pending(void)
+{
+    const uint8_t *span;
+    return ring_buffer_read_span(console_rx, &span) != 0;
+}
+
+/**
+ * Splits the first word off *line, in place, and returns it; "" when there are no more.
+ */
+static char *console_word(char **line)
+{
+    char *p = *line;
+    while (*p == ' ') {
+        p++;
+    }
+    char *word = p;
+    while (*p && (*p != ' ')) {
+        p++;
+    }
+    if (*p) {
+        *p++ = 0;
+    }
+    *line = p;
+    return word;
+}
+
+static void console_level(char *arg)
+{
+    for (uint32_t i = 0; i < sizeof(console_levels) / sizeof(console_levels[0]); i++) {
+        if (!strcmp(arg, console_levels[i])) {
+            trace_set_level(i);
+        }
+    }
+    TRACE(CONSOLE_LEVEL, trace_get_level());
+}
+
+static void console_cache(char *arg)
+{
+    if (!strcmp(arg, "on")) {
+        NVMCTRL->CTRLB.bit.CACHEDIS = 0;
+    } else if (!strcmp(arg, "off")) {
+        NVMCTRL->CTRLB.bit.CACHEDIS = 1;
+    }
+    TRACE(CONSOLE_CACHE, !NVMCTRL->CTRLB.bit.CACHEDIS);
+}
+
+static void console_execute(char *line, uint32_t len)
+{
+    TRACE_BLOB(CONSOLE_COMMAND, line, len);
+
+    char *cmd = console_word(&line);
+    char *arg = console_word(&line);
+    if (!*cmd) {
+        return;
+    } else if (console_overflow) {
+        TRACE(CONSOLE_UNKNOWN);
+    } else if (!strcmp(cmd, "help")) {
+        TRACE(CONSOLE_HELP);
+        TRACE(CONSOLE_HELP_2);
+    } else if (!strcmp(cmd, "stats")) {
+        TRACE(CONSOLE_IO, (uint32_t)(stats.bytes_read >> 10), (uint32_t)(stats.bytes_written >> 10),
+              stats.flash_erases, stats.overlay_hits, stats.overlay_misses);
+        TRACE(CONSOLE_IRQ, stats.usb_interrupts, stats.dmac_interrupts, stats.usb_resets,
+              stats.stalls, stats.trace_dropped);
+        TRACE(CONSOLE_STACK, stack_high_water(), stack_size());
+    } else if (!strcmp(cmd, "level")) {
+        console_level(arg);
+    } else if (!strcmp(cmd, "flush")) {
+        TRACE(CONSOLE_FLUSH);
+    } else if (!strcmp(cmd, "cache")) {
+        console_cache(arg);
+    } else {
+        TRACE(CONSOLE_UNKNOWN);
+    }
+}
+
+void console_poll(void)
+{
+    const uint8_t *span;
+    uint32_t n;
+    while ((n = ring_buffer_read_span(console_rx, &span)) != 0) {
+        for (uint32_t i = 0; i < n; i++) {
+            const char c = span[i];
+            if ((c == '\r') || (c == '\n')) {
+                if (console_len || console_overflow) {
+                    uint32_t ctx;
+                    console_line[console_len] = 0;
+                    interrupts_disable(&ctx);
+                    console_execute(console_line, console_len);
+                    interrupts_restore(&ctx);
+                }
+                console_len = 0;
+                console_overflow = 0;
+            } else if ((c == '\b') || (c == 0x7f)) {
+                if (console_len) {
+                    console_len--;
+                }
+            } else if (console_len < CONSOLE_LINE_MAX) {
+                console_line[console_len++] = c;
+            } else {
+                console_overflow = 1;
+            }
+        }
+        ring_buffer_read_commit(console_rx, n);
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include <stdint.h>
+
+#include "ring_buffer.h"
+
+/**
+ * A line-at-a-time command console on the UART's receive side, for poking at a running unit
+ * without reflashing it. SERCOM3_Handler puts received bytes in a ring and console_poll() picks
+ * whole lines out of it from the main loop, so nothing is parsed in interrupt context.
+ *
+ * The transmit side carries the binary trace, so there's no echo and replies come back as trace
+ * records (CONSOLE_* in trace_events.h), which tools/tracedecode.py prints in line with
+ * everything else. They're all at ERROR level so that they get out whatever the trace level is.
+ * With the trace decoder reading the serial port, commands can be sent with e.g.
+ * echo stats > /dev/ttyACM0.
+ *
+ *   help                        lists the commands
+ *   stats                       dumps the counters in stats.h
+ *   level [debug|info|error]    sets the trace level (see trace_set_level), or reports it
+ *   flush                       says there's nothing to flush: every medium writes straight
+ *                               through (see block_device.h)
+ *   cache [on|off]              turns the NVM controller's flash read cache on or off, or
+ *                               reports it
+ *
+ * Lines end with CR or LF; backspace works. Anything past CONSOLE_LINE_MAX characters makes the
+ * line unknown.
+ */
+#define CONSOLE_LINE_MAX 32
+
+/**
+ * Commands are read from rx.
+ */
+void console_init(ring_buffer_t *rx);
+
+/**
+ * Runs every complete line waiting in rx. Call from the main loop only; commands run with
+ * interrupts disabled, like anything else that traces from there.
+ */
+void console_poll(void);
+
+/**
+ * Nonzero if there's received input that console_poll() hasn't looked at yet. The main loop
+ * checks this with interrupts disabled before sleeping, so a byte that arrives just before the
+ * WFI can't sit there until the next USB interrupt.
+ */
+int console_pending(void);
+
+#endif
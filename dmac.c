@@ -0,0 +1,120 @@
+#include "dmac.h"
+
+#include "interrupt_utils.h"
+#include "samd21.h"
+
+// The DMAC fetches a channel's first descriptor from BASEADDR + 16 * channel and parks the state of
+// an interrupted transfer at WRBADDR + 16 * channel.
+static DmacDescriptor dmac_descriptors[DMAC_CHANNELS] __attribute__((aligned(16)));
+static DmacDescriptor dmac_writeback[DMAC_CHANNELS] __attribute__((aligned(16)));
+
+void dmac_init(void)
+{
+    PM->AHBMASK.reg |= PM_AHBMASK_DMAC;
+    PM->APBBMASK.reg |= PM_APBBMASK_DMAC;
+
+    DMAC->CTRL.reg = 0;
+    DMAC->CTRL.reg = DMAC_CTRL_SWRST;
+    while (DMAC->CTRL.reg & DMAC_CTRL_SWRST);
+
+    DMAC->BASEADDR.reg = (uint32_t)dmac_descriptors;
+    DMAC->WRBADDR.reg = (uint32_t)dmac_writeback;
+    DMAC->CTRL.reg = DMAC_CTRL_DMAENABLE | DMAC_CTRL_LVLEN(0xf);
+}
+
+/**
+ * Fills in the copy channel's descriptor for a word-wide memory to memory transfer of len bytes.
+ * Incrementing addresses are given as the address just past the end of the buffer, which is what
+ * the DMAC wants.
+ */
+static void dmac_setup_copy(uint32_t btctrl, const void *src, void *dst, uint32_t len)
+{
+    DmacDescriptor *desc = &dmac_descriptors[DMAC_CHANNEL_COPY];
+
+    desc->BTCTRL.reg = DMAC_BTCTRL_VALID | DMAC_BTCTRL_BEATSIZE_WORD | btctrl;
+    desc->BTCNT.reg = len / 4;
+    desc->SRCADDR.reg = (uint32_t)src + ((btctrl & DMAC_BTCTRL_SRCINC) ? len : 0);
+    desc->DSTADDR.reg = (uint32_t)dst + ((btctrl & DMAC_BTCTRL_DSTINC) ? len : 0);
+    desc->DESCADDR.reg = 0;
+}
+
+/**
+ * Kicks off the copy channel and waits for it to finish. The CH* registers talk to whichever
+ * channel CHID selects, so this has to run with interrupts disabled.
+ */
+static void dmac_run_copy(void)
+{
+    DMAC->CHID.reg = DMAC_CHANNEL_COPY;
+    DMAC->CHCTRLB.reg = DMAC_CHCTRLB_TRIGSRC(0) | DMAC_CHCTRLB_TRIGACT_BLOCK;
+    DMAC->CHINTFLAG.reg = DMAC_CHINTFLAG_MASK;
+    DMAC->CHCTRLA.reg = DMAC_CHCTRLA_ENABLE;
+    DMAC->SWTRIGCTRL.reg = (1 << DMAC_CHANNEL_COPY);
+
+    while (!(DMAC->CHINTFLAG.reg & (DMAC_CHINTFLAG_TCMPL | DMAC_CHINTFLAG_TERR)));
+    DMAC->CHINTFLAG.reg = DMAC_CHINTFLAG_MASK;
+}
+
+uint32_t dmac_copy_crc32(void *dst, const void *src, uint32_t len)
+{
+    dmac_setup_copy(DMAC_BTCTRL_SRCINC | DMAC_BTCTRL_DSTINC, src, dst, len);
+
+    // The CRC engine is shared too, so nothing else may touch it until the copy is done.
+    uint32_t ctx;
+    interrupts_disable(&ctx);
+
+    // The seed can only be loaded while the CRC engine is off; once it's on, it checksums every
+    // beat that the copy channel moves.
+    DMAC->CTRL.reg &= ~DMAC_CTRL_CRCENABLE;
+    DMAC->CRCCHKSUM.reg = 0xffffffff;
+    DMAC->CRCCTRL.reg = (DMAC_CRCCTRL_CRCBEATSIZE_WORD | DMAC_CRCCTRL_CRCPOLY_CRC32 |
+                         DMAC_CRCCTRL_CRCSRC(0x20 + DMAC_CHANNEL_COPY));
+    DMAC->CTRL.reg |= DMAC_CTRL_CRCENABLE;
+
+    dmac_run_copy();
+
+    const uint32_t crc = DMAC->CRCCHKSUM.reg;
+    DMAC->CTRL.reg &= ~DMAC_CTRL_CRCENABLE;
+    interrupts_restore(&ctx);
+    return crc;
+}
+
+void dmac_start_tx(uint8_t channel, uint8_t trigger, const void *src, volatile void *dst,
+                   uint32_t len)
+{
+    DmacDescriptor *desc = &dmac_descriptors[channel];
+
+    desc->BTCTRL.reg = DMAC_BTCTRL_VALID | DMAC_BTCTRL_BEATSIZE_BYTE | DMAC_BTCTRL_SRCINC;
+    desc->BTCNT.reg = len;
+    desc->SRCADDR.reg = (uint32_t)src + len;
+    desc->DSTADDR.reg = (uint32_t)dst;
+    desc->DESCADDR.reg = 0;
+
+    DMAC->CHID.reg = channel;
+    DMAC->CHCTRLB.reg = DMAC_CHCTRLB_TRIGSRC(trigger) | DMAC_CHCTRLB_TRIGACT_BEAT;
+    DMAC->CHINTFLAG.reg = DMAC_CHINTFLAG_MASK;
+    DMAC->CHINTENSET.reg = DMAC_CHINTENSET_TCMPL;
+    DMAC->CHCTRLA.reg = DMAC_CHCTRLA_ENABLE;
+}
+
+int dmac_transfer_complete(uint8_t channel)
+{
+    DMAC->CHID.reg = channel;
+    if (DMAC->CHINTFLAG.reg & DMAC_CHINTFLAG_TCMPL) {
+        DMAC->CHINTFLAG.reg = DMAC_CHINTFLAG_TCMPL;
+        return 1;
+    }
+    return 0;
+}
+
+void dmac_fill(void *dst, uint32_t value, uint32_t len)
+{
+    // the source address stays put, so every beat reads the same word
+    static uint32_t pattern;
+    pattern = value;
+    dmac_setup_copy(DMAC_BTCTRL_DSTINC, &pattern, dst, len);
+
+    uint32_t ctx;
+    interrupts_disable(&ctx);
+    dmac_run_copy();
+    interrupts_restore(&ctx);
+}
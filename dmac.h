@@ -0,0 +1,49 @@
+#ifndef DMAC_H
+#define DMAC_H
+
+#include <stdint.h>
+
+/**
+ * Owns the samd21's DMA controller: its descriptor and write-back tables and the assignment of
+ * channels to jobs. dmac_init() has to run before anything else in here is used.
+ */
+#define DMAC_CHANNELS 2
+
+#define DMAC_CHANNEL_COPY 0
+#define DMAC_CHANNEL_SERCOM3_TX 1
+
+void dmac_init(void);
+
+/**
+ * Copies len bytes from src to dst with a DMA channel and returns the CRC-32 that the DMAC's CRC
+ * engine computed over them on the way through, so checksumming a block costs no CPU cycles on top
+ * of moving it. src, dst and len must all be word aligned.
+ *
+ * The value is the engine's raw checksum register. It's only meant to be compared against other
+ * values produced by this function, not against a software CRC-32.
+ */
+uint32_t dmac_copy_crc32(void *dst, const void *src, uint32_t len);
+
+/**
+ * Fills len bytes at dst with copies of value using a DMA channel. dst and len must be word
+ * aligned.
+ */
+void dmac_fill(void *dst, uint32_t value, uint32_t len);
+
+/**
+ * Starts channel feeding len bytes from src into a peripheral's data register at dst, one byte
+ * each time the peripheral raises trigger (one of the *_DMAC_ID_* trigger sources). The channel's
+ * transfer complete interrupt is enabled, so DMAC_Handler runs once at the end of the whole span.
+ *
+ * The CH* registers are shared between channels, so this and dmac_transfer_complete must be called
+ * with interrupts disabled or from DMAC_Handler.
+ */
+void dmac_start_tx(uint8_t channel, uint8_t trigger, const void *src, volatile void *dst,
+                   uint32_t len);
+
+/**
+ * Returns nonzero, and acknowledges the interrupt, if channel has finished its transfer.
+ */
+int dmac_transfer_complete(uint8_t channel);
+
+#endif
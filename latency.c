@@ -0,0 +1,132 @@
+#include "latency.h"
+
+#if defined(LATENCY_STATS)
+
+#include "timestamp.h"
+
+#include <string.h>
+
+typedef struct latency_histogram
+{
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint32_t buckets[LATENCY_BUCKETS];
+} latency_histogram_t;
+
+typedef struct latency
+{
+    uint8_t opcodes[LATENCY_SLOTS];
+    uint8_t slots_used;
+    uint32_t untracked;
+    latency_histogram_t histograms[LATENCY_SLOTS][LATENCY_PHASES];
+
+    // the command in flight; slot is 0 if it isn't being tracked
+    latency_histogram_t *slot;
+    uint32_t cbw_time;
+    uint32_t last_data_time;
+    uint8_t have_data;
+} latency_t;
+
+static latency_t latency;
+
+void latency_reset(void)
+{
+    memset(&latency, 0, sizeof(latency));
+    for (int i = 0; i < LATENCY_SLOTS; i++) {
+        for (int j = 0; j < LATENCY_PHASES; j++) {
+            latency.histograms[i][j].min = 0xffffffff;
+        }
+    }
+}
+
+static void latency_record(latency_histogram_t *h, uint32_t cycles)
+{
+    // log2 by shifting; there's no CLZ instruction on the M0+, and this is at most a few dozen
+    // cycles, three times a command.
+    uint32_t bucket = 0;
+    for (uint32_t c = cycles >> LATENCY_BUCKET_MIN_LOG2;
+         (c > 1) && (bucket < (LATENCY_BUCKETS - 1)); c >>= 1) {
+        bucket++;
+    }
+
+    h->count++;
+    h->buckets[bucket]++;
+    if (cycles < h->min) {
+        h->min = cycles;
+    }
+    if (cycles > h->max) {
+        h->max = cycles;
+    }
+}
+
+void latency_cbw(uint8_t opcode)
+{
+    latency.cbw_time = timestamp_now();
+    latency.have_data = 0;
+    latency.slot = 0;
+
+    int i;
+    for (i = 0; (i < latency.slots_used) && (latency.opcodes[i] != opcode); i++);
+    if (i == latency.slots_used) {
+        if (i == LATENCY_SLOTS) {
+            latency.untracked++;
+            return;
+        }
+        latency.opcodes[i] = opcode;
+        latency.slots_used++;
+    }
+    latency.slot = latency.histograms[i];
+}
+
+void latency_data(void)
+{
+    if (!latency.slot) {
+        return;
+    }
+
+    const uint32_t now = timestamp_now();
+    if (!latency.have_data) {
+        latency_record(&latency.slot[LATENCY_PHASE_FIRST_DATA], now - latency.cbw_time);
+        latency.have_data = 1;
+    }
+    latency.last_data_time = now;
+}
+
+void latency_csw(void)
+{
+    if (!latency.slot) {
+        return;
+    }
+
+    const uint32_t now = timestamp_now();
+    if (latency.have_data) {
+        latency_record(&latency.slot[LATENCY_PHASE_STATUS], now - latency.last_data_time);
+    }
+    latency_record(&latency.slot[LATENCY_PHASE_TOTAL], now - latency.cbw_time);
+    latency.slot = 0;
+}
+
+int latency_report(uint8_t slot, uint8_t *buf)
+{
+    if (slot >= LATENCY_SLOTS) {
+        return -1;
+    }
+
+    const uint32_t hz = TIMESTAMP_HZ;
+    buf[0] = LATENCY_REPORT_VERSION;
+    buf[1] = LATENCY_SLOTS;
+    buf[2] = latency.slots_used;
+    buf[3] = latency.opcodes[slot];
+    buf[4] = LATENCY_PHASES;
+    buf[5] = LATENCY_BUCKETS;
+    buf[6] = LATENCY_BUCKET_MIN_LOG2;
+    buf[7] = 0;
+    // (the M0+ is little endian, like the report)
+    memcpy(&buf[8], &hz, 4);
+    memcpy(&buf[12], &latency.untracked, 4);
+    memcpy(&buf[16], latency.histograms[slot], sizeof(latency.histograms[slot]));
+    return 0;
+}
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+
+/**
+ * Latency histograms for the phases of a SCSI command, kept per opcode, timed with the timestamp
+ * counter. Everything here compiles away to nothing unless the firmware is built with
+ * LATENCY_STATS.
+ *
+ * Opcodes get a slot each the first time they're seen; once all LATENCY_SLOTS are taken,
+ * commands with new opcodes are only counted as untracked.
+ *
+ * Bucket n of a histogram counts latencies of 2^(n + LATENCY_BUCKET_MIN_LOG2) cycles up to twice
+ * that. The first bucket also takes anything shorter and the last anything longer.
+ */
+#define LATENCY_PHASE_FIRST_DATA 0  // CBW arrival to the first data packet
+#define LATENCY_PHASE_STATUS 1      // last data packet to the CSW
+#define LATENCY_PHASE_TOTAL 2       // CBW arrival to the CSW
+#define LATENCY_PHASES 3
+
+#ifndef LATENCY_SLOTS
+#define LATENCY_SLOTS 8
+#endif
+
+#define LATENCY_BUCKET_MIN_LOG2 8
+#define LATENCY_BUCKETS 20
+
+/**
+ * What latency_report writes for one slot. All fields are little endian.
+ *
+ *      0  uint8_t   version (LATENCY_REPORT_VERSION)
+ *      1  uint8_t   LATENCY_SLOTS
+ *      2  uint8_t   slots in use
+ *      3  uint8_t   this slot's opcode
+ *      4  uint8_t   LATENCY_PHASES
+ *      5  uint8_t   LATENCY_BUCKETS
+ *      6  uint8_t   LATENCY_BUCKET_MIN_LOG2
+ *      7  uint8_t   reserved
+ *      8  uint32_t  timestamp clock in Hz
+ *     12  uint32_t  untracked commands
+ *     16  per phase: uint32_t count, min, max, buckets[LATENCY_BUCKETS]
+ *
+ * min is meaningless while count is 0.
+ */
+#define LATENCY_REPORT_VERSION 1
+#define LATENCY_REPORT_SIZE (16 + (LATENCY_PHASES * 4 * (3 + LATENCY_BUCKETS)))
+
+#if defined(LATENCY_STATS)
+
+/**
+ * Called from the SCSI layer as a command's CBW arrives, as each of its data packets is
+ * sent or received, and as its CSW is queued.
+ */
+void latency_cbw(uint8_t opcode);
+void latency_data(void);
+void latency_csw(void);
+
+/**
+ * Writes slot's report (LATENCY_REPORT_SIZE bytes) to buf. Returns nonzero if there's no such
+ * slot.
+ */
+int latency_report(uint8_t slot, uint8_t *buf);
+
+/**
+ * Clears every slot, including which opcode it belongs to.
+ */
+void latency_reset(void);
+
+#else
+
+static inline void latency_cbw(uint8_t opcode) { }
+static inline void latency_data(void) { }
+static inline void latency_csw(void) { }
+static inline void latency_reset(void) { }
+
+#endif
+
+#endif
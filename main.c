@@ -8,10 +8,23 @@
 
 #include "samd21.h"
 
-#include "char_buffer.h"
+#include "console.h"
+#include "dmac.h"
 #include "interrupt_utils.h"
+#include "mtb.h"
+#include "overlay.h"
+#include "ramdisk.h"
+#include "ring_buffer.h"
+#include "romdisk.h"
 #include "scsi.h"
+#include "serial_number.h"
+#include "sparse.h"
+#include "stats.h"
+#include "timestamp.h"
+#include "trace.h"
+#include "uf2.h"
 #include "usb_descriptors.h"
+#include "vfat.h"
 
 #include <stdint.h>
 #include <string.h>
@@ -28,121 +41,162 @@
 
 const volatile uint8_t *NVM_SOFTWARE_CAL_AREA = (void*)0x806020;
 
-volatile char_buffer_t sercom3_tx_buf;
-uint8_t sercom3_tx_buf_space[2048];
+#ifndef SERCOM3_TX_BUF_SIZE
+#define SERCOM3_TX_BUF_SIZE 2048
+#endif
+#if (SERCOM3_TX_BUF_SIZE & (SERCOM3_TX_BUF_SIZE - 1)) != 0
+#error "SERCOM3_TX_BUF_SIZE must be a power of two"
+#endif
 
-static volatile UsbDeviceDescriptor endpoint_descriptors[8] __attribute__((aligned(4))) = { 0 };
+/**
+ * The log ring carries trace records (see trace.h). It has one producer, whichever context is
+ * tracing, and one consumer, DMAC_Handler.
+ * Tracing happens from USB_Handler, which DMAC_Handler can't preempt, and from the main loop only
+ * with interrupts disabled, so there's never more than one producer at once and neither side
+ * needs a critical section around the ring itself.
+ */
+ring_buffer_t sercom3_tx_buf;
+uint8_t sercom3_tx_buf_space[SERCOM3_TX_BUF_SIZE];
 
-uint8_t ep0_out_buf[64];
-uint8_t ep0_in_buf[64];
+#ifndef SERCOM3_RX_BUF_SIZE
+#define SERCOM3_RX_BUF_SIZE 64
+#endif
+#if (SERCOM3_RX_BUF_SIZE & (SERCOM3_RX_BUF_SIZE - 1)) != 0
+#error "SERCOM3_RX_BUF_SIZE must be a power of two"
+#endif
 
-uint8_t ep1_in_buf[64];
-uint8_t ep2_out_buf[64];
+/**
+ * Console input (see console.h). SERCOM3_Handler is the only producer and the main loop the only
+ * consumer. Whatever doesn't fit is thrown away; someone typing can't outrun the main loop.
+ */
+ring_buffer_t sercom3_rx_buf;
+uint8_t sercom3_rx_buf_space[SERCOM3_RX_BUF_SIZE];
+
+#if defined(MEDIUM_VFAT)
+#ifndef VFAT_BLOCKS
+#define VFAT_BLOCKS 16384
+#endif
+#if VFAT_BLOCKS < VFAT_MIN_BLOCKS
+#error "VFAT_BLOCKS is too small for a FAT16 volume (see VFAT_MIN_BLOCKS)"
+#elif VFAT_BLOCKS > VFAT_MAX_BLOCKS
+#error "VFAT_BLOCKS is too big for a FAT16 volume (see VFAT_MAX_BLOCKS)"
+#endif
+
+static const char vfat_readme[] =
+    "awful flash drive\r\n"
+    "\r\n"
+    "Everything on this drive is generated by the firmware as it's read.\r\n";
+
+#define VFAT_STATUS_BUILT "\r\nbuilt: " __DATE__ " " __TIME__ "\r\n"
 
-void SERCOM3_putch(char ch)
+/**
+ * STATUS.TXT: the chip's 128 bit serial number and when the firmware was built.
+ */
+static void vfat_status_read(const vfat_file_t *file, uint32_t offset, uint8_t *buf)
 {
-    uint32_t ctx;
-    //interrupts_disable(&ctx);
-    asm volatile("cpsid i");
-    if (SERCOM3->USART.INTENSET.reg & SERCOM_USART_INTENSET_DRE) {
-        // If the txempty interrupt is already enabled, it's expecting data in the buffer
-        char_buffer_putc(&sercom3_tx_buf, ch);
-    } else {
-        // put char in and enable interrupt
-        SERCOM3->USART.INTENSET.reg = SERCOM_USART_INTENSET_DRE;
-        SERCOM3->USART.DATA.reg = ch;
-    }
-    //interrupts_restore(&ctx);
-    asm volatile ("cpsie i");
+    char *p = (char*)buf;
+    memcpy(p, "serial: ", 8);
+    p += 8;
+    serial_number_hex(p);
+    p += SERIAL_NUMBER_HEX_LEN;
+    memcpy(p, VFAT_STATUS_BUILT, sizeof(VFAT_STATUS_BUILT) - 1);
 }
 
-
-void SERCOM3_puts(const char *s)
+static const vfat_file_t vfat_files[] =
 {
-    for (; *s; s++)
-        SERCOM3_putch(*s);
-}
+    { "README  TXT", sizeof(vfat_readme) - 1, (const uint8_t *)vfat_readme, 0 },
+    { "STATUS  TXT", 8 + SERIAL_NUMBER_HEX_LEN + sizeof(VFAT_STATUS_BUILT) - 1, 0,
+      vfat_status_read },
+};
+#elif defined(MEDIUM_UF2)
+// The volume the host sees while we're waiting for a UF2 file. Its contents don't matter much;
+// UF2 blocks are recognized no matter where they're written.
+static const char uf2_info[] =
+    "UF2 Bootloader\r\n"
+    "Model: awful flash drive\r\n"
+    "Board-ID: SAMD21J18A-Xplained-Pro\r\n";
+
+static const vfat_file_t vfat_files[] =
+{
+    { "INFO_UF2TXT", sizeof(uf2_info) - 1, (const uint8_t *)uf2_info, 0 },
+};
+#endif
+
+static block_device_t base_medium;
+static block_device_t medium;
+#if defined(MEDIUM_SPARSE)
+static block_device_t sparse_base;
+#endif
+#if defined(RAMDISK_LUN)
+static block_device_t scratch_medium;
+#endif
+static scsi_state_t scsi_state;
 
+static volatile UsbDeviceDescriptor endpoint_descriptors[8] __attribute__((aligned(4))) = { 0 };
 
-void SERCOM3_putx(uint32_t x)
-{
-    for (int i = 0; i < 8; i++, x <<= 4) {
-        uint8_t buux = ((x & 0xf0000000) >> 28);
-        if (buux <= 9) {
-            buux += '0';
-        } else {
-            buux += ('a' - 10);
-        }
-        SERCOM3_putch((char)buux);
-    }
-}
+uint8_t ep0_out_buf[64];
+uint8_t ep0_in_buf[64];
 
-void SERCOM3_putx8(uint8_t x)
-{
-    for (int i = 0; i < 2; i++, x <<= 4) {
-        uint8_t buux = ((x & 0xf0) >> 4);
-        if (buux <= 9) {
-            buux += '0';
-        } else {
-            buux += ('a' - 10);
-        }
-        SERCOM3_putch((char)buux);
-    }
-}
+uint8_t ep1_in_buf[64];
+uint8_t ep2_out_buf[64];
 
+// Number of bytes the DMA channel is currently sending out of sercom3_tx_buf; 0 if it's idle.
+static volatile uint32_t sercom3_tx_dma_len;
 
-void SERCOM3_puti(uint32_t n)
+/**
+ * Hands the next contiguous run of sercom3_tx_buf to the DMA channel, which feeds it to the UART a
+ * byte at a time with no CPU involvement and interrupts once at the end. Only called from
+ * DMAC_Handler.
+ */
+static void sercom3_tx_start(void)
 {
-    char buf[33];
-    int i = 0;
-    do {
-        buf[i++] = (n % 10) + '0';
-        n /= 10;
-    } while(n);
-
-    for (int j = (i - 1); j >= 0; j--) {
-        SERCOM3_putch(buf[j]);
+    const uint8_t *span;
+    const uint32_t n = ring_buffer_read_span(&sercom3_tx_buf, &span);
+
+    sercom3_tx_dma_len = n;
+    if (n) {
+        dmac_start_tx(DMAC_CHANNEL_SERCOM3_TX, SERCOM3_DMAC_ID_TX, span,
+                      &SERCOM3->USART.DATA.reg, n);
     }
 }
 
-void hexprint(const uint8_t *data, int len)
+/**
+ * Called after every trace record. If the DMA channel is idle, DMAC_Handler is pended to get it
+ * going; it picks up everything queued so far.
+ */
+static void sercom3_tx_kick(void)
 {
-    for (int i = 0; i < len; i++) {
-        SERCOM3_putx8(data[i]);
-        SERCOM3_putch(' ');
-        if ((i & 0x0f) == 0x0f)
-            SERCOM3_puts("\r\n");
+    if (sercom3_tx_dma_len == 0) {
+        NVIC_SetPendingIRQ(DMAC_IRQn);
     }
 }
 
+void SERCOM3_Handler()
+{
+    // TX is done by DMA; see DMAC_Handler.
 
-void cbw_print(const usb_mass_storage_cbw_t *cbw) {
-    uint8_t *sig = (uint8_t*)&cbw->cbw_signature;
-    SERCOM3_puts("  sig: "); for(int i = 0; i < 4; SERCOM3_putch(sig[i++])); SERCOM3_puts("\r\n");
-    SERCOM3_puts("  tag: "); SERCOM3_putx8(cbw->cbw_tag); SERCOM3_puts("\r\n");
-    SERCOM3_puts("  len: "); SERCOM3_putx8(cbw->cbw_data_transfer_length); SERCOM3_puts("\r\n");
-    SERCOM3_puts("  flags: "); hexprint((uint8_t*)&cbw->cbw_flags, 1); SERCOM3_puts("\r\n");
-    SERCOM3_puts("  cbwcblen: "); hexprint((uint8_t*)&cbw->cbwcb_length, 1); SERCOM3_puts("\r\n");
-    hexprint(cbw->cbwcb, 16);SERCOM3_puts("\r\n");
+    while (SERCOM3->USART.INTFLAG.reg & SERCOM_USART_INTFLAG_RXC) {
+        const uint8_t c = SERCOM3->USART.DATA.reg;
+        ring_buffer_write(&sercom3_rx_buf, &c, 1);
+    }
+    if (SERCOM3->USART.STATUS.reg & SERCOM_USART_STATUS_BUFOVF) {
+        SERCOM3->USART.STATUS.reg = SERCOM_USART_STATUS_BUFOVF;
+    }
 }
 
-void SERCOM3_Handler()
+void DMAC_Handler()
 {
-    uint8_t sr_start = SERCOM3->USART.INTFLAG.reg;
-
-    // TX handling
-    if ((SERCOM3->USART.INTENSET.reg & SERCOM_USART_INTENSET_DRE) &&
-        (sr_start & SERCOM_USART_INTFLAG_DRE)) {
-        if (char_buffer_isempty(&sercom3_tx_buf)) {
-            SERCOM3->USART.INTENCLR.reg = SERCOM_USART_INTENSET_DRE;
-        } else {
-            uint8_t ch;
-            char_buffer_getc(&sercom3_tx_buf, &ch);
-            SERCOM3->USART.DATA.reg = ch;
-        }
-    }
+    stats.dmac_interrupts++;
 
-    // TODO RX
+    // One interrupt per span of log output instead of one per character. Also pended by
+    // sercom3_tx_kick when the channel is idle and there's new output.
+    if (dmac_transfer_complete(DMAC_CHANNEL_SERCOM3_TX)) {
+        ring_buffer_read_commit(&sercom3_tx_buf, sercom3_tx_dma_len);
+        sercom3_tx_dma_len = 0;
+    }
+    if (sercom3_tx_dma_len == 0) {
+        sercom3_tx_start();
+    }
 }
 
 
@@ -191,8 +245,10 @@ void init_hardware()
 
 
     // DFLL48M --> GEN0 --> core
-    //enable nvm cache and wait states, then switch over to DFLL48M for main clock
-    *((uint32_t*)0x41004004) = (1 << 1);
+    //enable nvm cache and wait states, then switch over to DFLL48M for main clock. MANW has to
+    //stay set (Reset_Handler sets it) or nvm_write_page's page buffer fills start writes by
+    //themselves.
+    NVMCTRL->CTRLB.reg = NVMCTRL_CTRLB_RWS(1) | NVMCTRL_CTRLB_MANW;
     GCLK->GENCTRL.reg = (GCLK_GENCTRL_GENEN |
                          GCLK_GENCTRL_SRC(GCLK_GENCTRL_SRC_DFLL48M_Val) |
                          GCLK_GENCTRL_ID(0));
@@ -203,6 +259,10 @@ void init_hardware()
     PORT->Group[0].PINCFG[22].reg = 1;
     PORT->Group[0].PINCFG[23].reg = 1;
 
+    // PA15 is SW0 on the xplained board. It shorts to ground when pressed, so it needs the pullup.
+    PORT->Group[0].OUTSET.reg = PORT_PA15;
+    PORT->Group[0].PINCFG[15].reg = PORT_PINCFG_INEN | PORT_PINCFG_PULLEN;
+
     // Initialize sercom3 as a UART running at a 921600 baud off of the DFLL48M
     PM->APBCMASK.reg |= (0x3f << 2);
     GCLK->CLKCTRL.reg = (1 << 14) | (0 << 8) | (0x13 << 0);
@@ -212,6 +272,7 @@ void init_hardware()
     SERCOM3->USART.CTRLB.reg = (1 << 17) | (1 << 16);
     SERCOM3->USART.CTRLA.reg |= (1 << 1);
     SERCOM3->USART.INTENCLR.reg = SERCOM_USART_INTENCLR_DRE;
+    SERCOM3->USART.INTENSET.reg = SERCOM_USART_INTENSET_RXC;
 
     // USB clock configurations. No APBBMASK needed, USB enabled by default.
     GCLK->CLKCTRL.reg = (1 << 14) | (0 << 8) | (0x06 << 0);
@@ -273,22 +334,110 @@ void init_hardware()
 
 int main()
 {
-    char_buffer_init(&sercom3_tx_buf, sercom3_tx_buf_space, sizeof(sercom3_tx_buf_space));
+#if defined(MEDIUM_UF2)
+    // Hand straight over to the application unless SW0 is held down during reset (or there's no
+    // application yet).
+    PORT->Group[0].OUTSET.reg = PORT_PA15;
+    PORT->Group[0].PINCFG[15].reg = PORT_PINCFG_INEN | PORT_PINCFG_PULLEN;
+    for (volatile int i = 0; i < 1000; i++);
+    if (PORT->Group[0].IN.reg & PORT_PA15) {
+        uf2_boot_app();
+    }
+#endif
+
+    ring_buffer_init(&sercom3_tx_buf, sercom3_tx_buf_space, sizeof(sercom3_tx_buf_space));
+    ring_buffer_init(&sercom3_rx_buf, sercom3_rx_buf_space, sizeof(sercom3_rx_buf_space));
+    timestamp_init();
+    trace_init(&sercom3_tx_buf, sercom3_tx_kick);
+
+    // Media checksum their blocks with the DMAC's CRC engine, starting with their initial contents,
+    // and the UART log goes out by DMA.
+    dmac_init();
+
+#if defined(MEDIUM_ROMDISK) && defined(MEDIUM_OVERLAY)
+    romdisk_init(&base_medium);
+    overlay_init(&medium, &base_medium);
+#elif defined(MEDIUM_ROMDISK)
+    romdisk_init(&medium);
+#elif defined(MEDIUM_VFAT)
+    vfat_init(&medium, vfat_files, sizeof(vfat_files) / sizeof(vfat_files[0]), VFAT_BLOCKS);
+#elif defined(MEDIUM_UF2)
+    vfat_init(&base_medium, vfat_files, sizeof(vfat_files) / sizeof(vfat_files[0]), 16384);
+    uf2_init(&medium, &base_medium);
+#else
+    ramdisk_init(&medium);
+#endif
+#if defined(MEDIUM_SPARSE)
+    // elide zero sectors on their way to whichever medium was picked above
+    sparse_base = medium;
+    sparse_init(&medium, &sparse_base);
+#endif
+    scsi_init(&scsi_state);
+    scsi_add_lun(&scsi_state, &medium, SCSI_LOGICAL_BLOCK_SHIFT, 0);
+#if defined(RAMDISK_LUN)
+    // a scratch RAM disk next to the main medium
+    ramdisk_init(&scratch_medium);
+    scsi_add_lun(&scsi_state, &scratch_medium, SCSI_LOGICAL_BLOCK_SHIFT, 0);
+#endif
+    console_init(&sercom3_rx_buf);
 
     //
     init_hardware();
 
     // enable sercom interrupts in nvic
+    // queued now, sent as soon as the DMAC interrupt is enabled
+    TRACE(BOOT);
     NVIC_EnableIRQ(SERCOM3_IRQn);
+    NVIC_EnableIRQ(DMAC_IRQn);
     NVIC_EnableIRQ(USB_IRQn);
     asm volatile("cpsie if");
 
-    SERCOM3_puts("=================\r\n");
-
     // startup PORT peripheral in power manager
     // nothing to do. on by default.
+    uint32_t sw0_last = PORT_PA15;
     while(1) {
-
+        // SW0 reverts the medium (e.g. drops the ROM disk's overlay) on the falling edge, unless
+        // the host has locked it in place.
+        const uint32_t sw0 = PORT->Group[0].IN.reg & PORT_PA15;
+        if (!sw0 && sw0_last && medium.revert && !scsi_medium_removal_prevented(&scsi_state, 0)) {
+            uint32_t ctx;
+            interrupts_disable(&ctx);
+            medium.revert(&medium);
+            scsi_medium_changed(&scsi_state, 0);
+            TRACE(MEDIUM_REVERTED);
+            interrupts_restore(&ctx);
+        }
+        sw0_last = sw0;
+
+#if defined(MEDIUM_UF2)
+        // Give the CSW for the last block a moment to make it out, then drop off the bus and
+        // reboot into the new application.
+        if (uf2_complete()) {
+            uint32_t ctx;
+            interrupts_disable(&ctx);
+            TRACE(UF2_COMPLETE);
+            interrupts_restore(&ctx);
+            for (volatile uint32_t i = 0; i < 500000; i++);
+            USB->DEVICE.CTRLB.bit.DETACH = 1;
+            NVIC_SystemReset();
+        }
+#endif
+
+        console_poll();
+
+        // Once the host has stopped every LUN there's nothing to do until it sends another
+        // command, so gate the CPU clock until the next interrupt. USB keeps running and wakes it
+        // within a few cycles. Interrupts are off between checking for console input and the
+        // WFI so that a byte can't slip in between; a pending interrupt still wakes the core.
+        if (scsi_idle(&scsi_state)) {
+            uint32_t ctx;
+            interrupts_disable(&ctx);
+            if (!console_pending()) {
+                PM->SLEEP.reg = PM_SLEEP_IDLE_CPU;
+                __WFI();
+            }
+            interrupts_restore(&ctx);
+        }
     }
 }
 
@@ -398,6 +547,13 @@ int32_t fill_setup_response(volatile usb_device_request_t *req, volatile uint8_t
             break;
         }
 
+        // mass storage class: GET_MAX_LUN
+        case 0xfe: {
+            dest[0] = scsi_max_lun(&scsi_state);
+            bytes_filled = (req->length > 1) ? 1 : req->length;
+            break;
+        }
+
         default: {
             bytes_filled = -1;
             break;
@@ -414,11 +570,14 @@ void USB_Handler()
 {
     static uint8_t addr = 0;
 
-    static scsi_state_t scsi_state = { 0 };
+    MTB_ISR_BEGIN();
+    stats.usb_interrupts++;
 
     // handle usb events
     if (USB->DEVICE.INTFLAG.bit.EORST) {
-        SERCOM3_puts("USB reset\r\n");
+        TRACE(USB_RESET);
+        stats.usb_resets++;
+        scsi_reset(&scsi_state);
         USB->DEVICE.DeviceEndpoint[0].EPCFG.bit.EPTYPE0 = 1;
         USB->DEVICE.DeviceEndpoint[0].EPCFG.bit.EPTYPE1 = 1;
         USB->DEVICE.DeviceEndpoint[0].EPINTENSET.bit.RXSTP = 1;
@@ -451,11 +610,8 @@ void USB_Handler()
         // Check and see if a setup packet was rx'd. If it was, either fill the buffer with the
         // requested data or latch the request and prepare to recieve a command IN stage.
         if (USB->DEVICE.DeviceEndpoint[0].EPINTFLAG.bit.RXSTP) {
-            SERCOM3_puts("got SETUP, ");
-            SERCOM3_putx(endpoint_descriptors[0].DeviceDescBank[0].PCKSIZE.bit.BYTE_COUNT);
-            SERCOM3_puts(" bytes:\r\n");
-            hexprint(ep0_out_buf, 8);
-            SERCOM3_puts("\r\n");
+            TRACE_BLOB(EP0_SETUP, ep0_out_buf, 8,
+                       endpoint_descriptors[0].DeviceDescBank[0].PCKSIZE.bit.BYTE_COUNT);
 
             // save setup request
             memcpy(&request, ep0_out_buf, 8);
@@ -465,7 +621,8 @@ void USB_Handler()
                 int32_t bytes_to_send = fill_setup_response(&request, (void *)ep0_in_buf);
                 if (bytes_to_send < 0) {
                     // STALL
-                    SERCOM3_puts("responding with STALL\r\n");
+                    TRACE(EP0_STALL);
+                    stats.stalls++;
                     USB->DEVICE.DeviceEndpoint[0].EPSTATUSSET.bit.STALLRQ1 = 1;
                 } else {
                     endpoint_descriptors[0].DeviceDescBank[1].PCKSIZE.bit.BYTE_COUNT = bytes_to_send;
@@ -492,12 +649,22 @@ void USB_Handler()
                                                         ep2_out_buf,
                                                         0,
                                                         ep1_in_buf);
+                    TRACE(EP1_HALT_CLEAR, bytes_to_send);
                     if (bytes_to_send >= 0) {
-                        SERCOM3_puts("quaz\r\n");
                         endpoint_descriptors[1].DeviceDescBank[1].PCKSIZE.bit.BYTE_COUNT = bytes_to_send;
                         USB->DEVICE.DeviceEndpoint[1].EPSTATUSSET.bit.BK1RDY = 1;
                     }
+                } else if ((request.request == 1) && (request.index == 0x0002)) {
+                    endpoint_descriptors[0].DeviceDescBank[1].PCKSIZE.bit.BYTE_COUNT = 0;
+                    USB->DEVICE.DeviceEndpoint[0].EPSTATUSSET.bit.BK1RDY = 1;
+
+                    USB->DEVICE.DeviceEndpoint[2].EPINTFLAG.reg = USB_DEVICE_EPINTFLAG_STALL0;
+                    USB->DEVICE.DeviceEndpoint[2].EPSTATUSCLR.bit.STALLRQ0 = 1;
                 } else {
+                    // mass storage class: Bulk-Only Mass Storage Reset
+                    if ((request.request_type == 0x21) && (request.request == 0xff)) {
+                        scsi_reset(&scsi_state);
+                    }
                     endpoint_descriptors[0].DeviceDescBank[1].PCKSIZE.bit.BYTE_COUNT = 0;
                     USB->DEVICE.DeviceEndpoint[0].EPSTATUSSET.bit.BK1RDY = 1;
                 }
@@ -515,11 +682,7 @@ void USB_Handler()
 
         if (USB->DEVICE.DeviceEndpoint[0].EPINTFLAG.bit.TRCPT0) {
             uint8_t bytes = endpoint_descriptors[0].DeviceDescBank[0].PCKSIZE.bit.BYTE_COUNT;
-            SERCOM3_puts("TRCPT, ");
-            SERCOM3_putx(bytes);
-            SERCOM3_puts(" bytes:\r\n");
-            hexprint(ep0_out_buf, bytes);
-            SERCOM3_puts("\r\n");
+            TRACE_BLOB(EP0_OUT, ep0_out_buf, bytes, bytes);
 
             USB->DEVICE.DeviceEndpoint[0].EPSTATUSCLR.bit.BK0RDY = 1;
             USB->DEVICE.DeviceEndpoint[0].EPINTFLAG.reg = USB_DEVICE_EPINTFLAG_TRCPT0;
@@ -538,9 +701,7 @@ void USB_Handler()
         // ugh so much spaghetti
         if (USB->DEVICE.DeviceEndpoint[1].EPINTFLAG.bit.TRCPT1) {
             uint8_t bytes = endpoint_descriptors[1].DeviceDescBank[1].PCKSIZE.bit.BYTE_COUNT;
-            SERCOM3_puts("EP1 TX finished:\r\n");
-            hexprint((uint8_t*)(ep1_in_buf), bytes);
-            SERCOM3_puts("\r\n\r\n");
+            TRACE_BLOB(EP1_IN, ep1_in_buf, bytes, bytes);
 
             int32_t bytes_to_send = scsi_handle(&scsi_state,
                                                 USB_TRANSFER_DIRECTION_IN,
@@ -554,9 +715,12 @@ void USB_Handler()
             if (bytes_to_send >= 0) {
                 endpoint_descriptors[1].DeviceDescBank[1].PCKSIZE.bit.BYTE_COUNT = bytes_to_send;
                 USB->DEVICE.DeviceEndpoint[1].EPSTATUSSET.bit.BK1RDY = 1;
+            } else if (bytes_to_send == -2) {
+                USB->DEVICE.DeviceEndpoint[1].EPSTATUSSET.bit.STALLRQ1 = 1;
+                stats.stalls++;
             }
         } else if (USB->DEVICE.DeviceEndpoint[1].EPINTFLAG.bit.STALL1) {
-            SERCOM3_puts("EP1 STALL sent.\r\n");
+            TRACE(EP1_STALL);
 /*            int32_t bytes_to_send = scsi_handle(&scsi_state,
                                                 USB_TRANSFER_DIRECTION_IN_STALL,
                                                 ep2_out_buf,
@@ -576,15 +740,24 @@ void USB_Handler()
 
     if (USB->DEVICE.EPINTSMRY.bit.EPINT2) {
         uint8_t bytes = endpoint_descriptors[2].DeviceDescBank[0].PCKSIZE.bit.BYTE_COUNT;
+        const int is_cbw = (scsi_state.current_state == CBW_FLOW_EXPECTING_CBW_STATE) &&
+                           (bytes == sizeof(scsi_state.cbw)) &&
+                           (memcmp(ep2_out_buf, "USBC", 4) == 0);
         int32_t bytes_to_send = scsi_handle(&scsi_state,
                                             USB_TRANSFER_DIRECTION_OUT,
                                             ep2_out_buf,
                                             bytes,
                                             ep1_in_buf);
 
-        SERCOM3_puts("RX CBW: \r\n");
-        cbw_print(&(scsi_state.cbw));
-        SERCOM3_puts("\r\n");
+        TRACE(EP2_OUT, bytes);
+        if (is_cbw) {
+            const usb_mass_storage_cbw_t *cbw = &scsi_state.cbw;
+            // bCBWCBLength comes from the host and can claim more than the 16 byte block
+            const uint32_t cb_length = (cbw->cbwcb_length < sizeof(cbw->cbwcb)) ?
+                cbw->cbwcb_length : sizeof(cbw->cbwcb);
+            TRACE_BLOB(CBW, cbw->cbwcb, cb_length, cbw->cbw_tag,
+                       cbw->cbw_data_transfer_length, cbw->cbw_flags, cbw->cbw_lun);
+        }
 
         USB->DEVICE.DeviceEndpoint[2].EPSTATUSCLR.bit.BK0RDY = 1;
         USB->DEVICE.DeviceEndpoint[2].EPINTFLAG.reg = USB_DEVICE_EPINTFLAG_TRCPT0;
@@ -596,8 +769,9 @@ void USB_Handler()
             // TODO: stall IN endpoint
             // make sure to service STALL interrupt
             USB->DEVICE.DeviceEndpoint[1].EPSTATUSSET.bit.STALLRQ1 = 1;
+            stats.stalls++;
         }
     }
 
-    SERCOM3_puts("\r\n");
+    MTB_ISR_END();
 }
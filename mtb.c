@@ -0,0 +1,71 @@
+#include "mtb.h"
+
+#if defined(MTB_CAPTURE_ISR) || defined(MTB_CAPTURE_COMMAND)
+
+#include "samd21.h"
+#include "trace.h"
+
+// MASTER.MASK: the buffer wraps every 2^(MTB_MASK + 4) bytes, and has to be aligned to that.
+#if (MTB_BUFFER_SIZE == 128)
+#define MTB_MASK 3
+#elif (MTB_BUFFER_SIZE == 256)
+#define MTB_MASK 4
+#elif (MTB_BUFFER_SIZE == 512)
+#define MTB_MASK 5
+#elif (MTB_BUFFER_SIZE == 1024)
+#define MTB_MASK 6
+#else
+#error "MTB_BUFFER_SIZE must be 128, 256, 512 or 1024"
+#endif
+
+static uint8_t mtb_buffer[MTB_BUFFER_SIZE] __attribute__((aligned(MTB_BUFFER_SIZE)));
+
+// regions left to skip before the next capture
+static uint32_t mtb_countdown;
+static uint8_t mtb_running;
+
+void mtb_begin(void)
+{
+    if (mtb_countdown) {
+        mtb_countdown--;
+        return;
+    }
+
+    // POSITION is relative to BASE, which is the start of SRAM.
+    MTB->POSITION.reg = ((uint32_t)mtb_buffer - MTB->BASE.reg) & MTB_POSITION_POINTER_Msk;
+    MTB->MASTER.reg = MTB_MASTER_EN | MTB_MASTER_MASK(MTB_MASK);
+    mtb_running = 1;
+}
+
+void mtb_end(void)
+{
+    if (!mtb_running) {
+        return;
+    }
+    MTB->MASTER.reg = MTB_MASTER_MASK(MTB_MASK);
+    mtb_running = 0;
+    mtb_countdown = MTB_INTERVAL;
+
+    // If the pointer wrapped, the oldest packet is the one it's pointing at; otherwise the buffer
+    // is only filled up to it.
+    const uint32_t position = MTB->POSITION.reg;
+    const uint32_t next = position & MTB_POSITION_POINTER_Msk & (MTB_BUFFER_SIZE - 1);
+    const uint32_t start = (position & MTB_POSITION_WRAP) ? next : 0;
+    const uint32_t len = (position & MTB_POSITION_WRAP) ? MTB_BUFFER_SIZE : next;
+
+    TRACE(MTB_CAPTURE, len >> 3);
+    for (uint32_t done = 0; done < len; ) {
+        const uint32_t at = (start + done) & (MTB_BUFFER_SIZE - 1);
+        uint32_t n = len - done;
+        if (n > (MTB_BUFFER_SIZE - at)) {
+            n = MTB_BUFFER_SIZE - at;
+        }
+        if (n > TRACE_BLOB_MAX) {
+            n = TRACE_BLOB_MAX;
+        }
+        TRACE_BLOB(MTB_PACKETS, &mtb_buffer[at], n);
+        done += n;
+    }
+}
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef MTB_H
+#define MTB_H
+
+#include <stdint.h>
+
+/**
+ * Branch capture with the Cortex-M0+ Micro Trace Buffer. While it's running, the MTB writes an 8
+ * byte packet into an SRAM buffer for every taken branch, exception entry and exception return,
+ * with no CPU overhead:
+ *
+ *     uint32_t source       address of the branch; bit 0 set if it's an exception entry or return
+ *     uint32_t destination  where it went; bit 0 set on the first packet after a start
+ *
+ * The buffer is circular, so it ends up holding the last MTB_BUFFER_SIZE / 8 branches of the
+ * region it was running across. Afterwards it goes out through the trace as an MTB_CAPTURE record
+ * and a run of MTB_PACKETS records, oldest first, and tools/mtbdecode.py maps it back to source
+ * lines with the ELF.
+ *
+ * Which region is captured is picked at build time: MTB_CAPTURE_ISR covers whole USB_Handler
+ * invocations and MTB_CAPTURE_COMMAND covers SCSI commands from CBW to CSW (including any other
+ * interrupts and the main loop in between). Only one region in every MTB_INTERVAL + 1 is captured,
+ * so the dumps don't swamp the log. Without either, all of this compiles away.
+ */
+#if defined(MTB_CAPTURE_ISR) || defined(MTB_CAPTURE_COMMAND)
+
+#ifndef MTB_BUFFER_SIZE
+#define MTB_BUFFER_SIZE 256
+#endif
+
+#ifndef MTB_INTERVAL
+#define MTB_INTERVAL 255
+#endif
+
+void mtb_begin(void);
+
+/**
+ * Stops the capture begun by the last mtb_begin, if there was one, and dumps it to the trace.
+ */
+void mtb_end(void);
+
+#else
+
+static inline void mtb_begin(void) { }
+static inline void mtb_end(void) { }
+
+#endif
+
+#if defined(MTB_CAPTURE_ISR)
+#define MTB_ISR_BEGIN() mtb_begin()
+#define MTB_ISR_END() mtb_end()
+#else
+#define MTB_ISR_BEGIN()
+#define MTB_ISR_END()
+#endif
+
+#if defined(MTB_CAPTURE_COMMAND)
+#define MTB_COMMAND_BEGIN() mtb_begin()
+#define MTB_COMMAND_END() mtb_end()
+#else
+#define MTB_COMMAND_BEGIN()
+#define MTB_COMMAND_END()
+#endif
+
+#endif
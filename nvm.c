@@ -0,0 +1,47 @@
+#include "nvm.h"
+
+#include "samd21.h"
+#include "stats.h"
+
+static int nvm_command(uint32_t cmd)
+{
+    NVMCTRL->CTRLA.reg = NVMCTRL_CTRLA_CMDEX_KEY | cmd;
+    while (!(NVMCTRL->INTFLAG.reg & NVMCTRL_INTFLAG_READY));
+
+    if (NVMCTRL->INTFLAG.reg & NVMCTRL_INTFLAG_ERROR) {
+        NVMCTRL->INTFLAG.reg = NVMCTRL_INTFLAG_ERROR;
+        NVMCTRL->STATUS.reg = NVMCTRL_STATUS_MASK;
+        return 1;
+    }
+    return 0;
+}
+
+int nvm_erase_row(uint32_t addr)
+{
+    while (!(NVMCTRL->INTFLAG.reg & NVMCTRL_INTFLAG_READY));
+
+    // ADDR takes a 16 bit word address
+    NVMCTRL->ADDR.reg = addr >> 1;
+    stats.flash_erases++;
+    return nvm_command(NVMCTRL_CTRLA_CMD_ER);
+}
+
+int nvm_write_page(uint32_t addr, const uint8_t *data)
+{
+    while (!(NVMCTRL->INTFLAG.reg & NVMCTRL_INTFLAG_READY));
+    if (nvm_command(NVMCTRL_CTRLA_CMD_PBC)) {
+        return 1;
+    }
+
+    // The page buffer only takes 16 and 32 bit writes. Reset_Handler and init_hardware set
+    // CTRLB.MANW, so filling it doesn't kick off a write by itself; the WP below does.
+    volatile uint32_t *dst = (volatile uint32_t *)addr;
+    const uint32_t *src = (const uint32_t *)data;
+    for (int i = 0; i < (NVM_PAGE_SIZE / 4); i++) {
+        dst[i] = src[i];
+    }
+
+    while (!(NVMCTRL->INTFLAG.reg & NVMCTRL_INTFLAG_READY));
+    NVMCTRL->ADDR.reg = addr >> 1;
+    return nvm_command(NVMCTRL_CTRLA_CMD_WP);
+}
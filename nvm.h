@@ -0,0 +1,24 @@
+#ifndef NVM_H
+#define NVM_H
+
+#include <stdint.h>
+
+/**
+ * Bare minimum for reprogramming the samd21's main flash array. Flash is erased a row (4 pages,
+ * 256 bytes) at a time and written a page (64 bytes) at a time. The CPU stalls on any flash fetch
+ * while the NVM controller is busy, so these are safe to call from code running out of flash.
+ *
+ * Both return 0 on success and nonzero if the NVM controller flagged an error (e.g. the region is
+ * locked).
+ */
+#define NVM_PAGE_SIZE 64
+#define NVM_ROW_SIZE (4 * NVM_PAGE_SIZE)
+
+int nvm_erase_row(uint32_t addr);
+
+/**
+ * data must be word aligned.
+ */
+int nvm_write_page(uint32_t addr, const uint8_t *data);
+
+#endif
@@ -0,0 +1,104 @@
+#include "overlay.h"
+
+#include "dmac.h"
+#include "stats.h"
+
+#include <string.h>
+
+#define OVERLAY_EMPTY 0xffffffff
+
+typedef struct overlay
+{
+    const block_device_t *base;
+    uint32_t used;
+
+    // remap table; keys[i] is an LBA (or OVERLAY_EMPTY) and slots[i] is where its data lives.
+    uint32_t keys[OVERLAY_HASH_SIZE];
+    uint8_t slots[OVERLAY_HASH_SIZE];
+
+    uint8_t pool[OVERLAY_BLOCKS][BLOCK_DEVICE_BLOCK_SIZE] __attribute__((aligned(4)));
+
+    // DMAC CRC of each pool block, taken when it was written and checked whenever it's read.
+    uint32_t crc[OVERLAY_BLOCKS];
+} overlay_t;
+
+static overlay_t overlay;
+
+/**
+ * Fibonacci hashing; the M0+ on the samd21 has the single cycle multiplier, so this is cheap.
+ */
+static uint32_t overlay_hash(uint32_t lba)
+{
+    return (lba * 2654435761u) >> (32 - OVERLAY_HASH_BITS);
+}
+
+/**
+ * Returns the remap table index where lba lives, or where it would be inserted if it isn't in the
+ * overlay yet. The table is never more than half full, so this always terminates.
+ */
+static uint32_t overlay_find(const overlay_t *ov, uint32_t lba)
+{
+    uint32_t i = overlay_hash(lba);
+    while ((ov->keys[i] != OVERLAY_EMPTY) && (ov->keys[i] != lba)) {
+        i = (i + 1) & (OVERLAY_HASH_SIZE - 1);
+    }
+    return i;
+}
+
+static int overlay_read(const block_device_t *dev, uint32_t lba, uint8_t *buf)
+{
+    const overlay_t *ov = dev->ctx;
+    const uint32_t i = overlay_find(ov, lba);
+
+    if (ov->keys[i] == lba) {
+        const uint32_t slot = ov->slots[i];
+        stats.overlay_hits++;
+        return dmac_copy_crc32(buf, ov->pool[slot], BLOCK_DEVICE_BLOCK_SIZE) != ov->crc[slot];
+    } else {
+        stats.overlay_misses++;
+        return ov->base->read(ov->base, lba, buf);
+    }
+}
+
+static int overlay_write(const block_device_t *dev, uint32_t lba, const uint8_t *buf)
+{
+    overlay_t *ov = dev->ctx;
+    const uint32_t i = overlay_find(ov, lba);
+
+    if (ov->keys[i] != lba) {
+        if (ov->used == OVERLAY_BLOCKS) {
+            return 1;
+        }
+        ov->keys[i] = lba;
+        ov->slots[i] = ov->used++;
+    }
+
+    const uint32_t slot = ov->slots[i];
+    ov->crc[slot] = dmac_copy_crc32(ov->pool[slot], buf, BLOCK_DEVICE_BLOCK_SIZE);
+    return 0;
+}
+
+static int overlay_revert(const block_device_t *dev)
+{
+    overlay_t *ov = dev->ctx;
+
+    memset(ov->keys, 0xff, sizeof(ov->keys));
+    ov->used = 0;
+    return 0;
+}
+
+void overlay_init(block_device_t *dev, const block_device_t *base)
+{
+    overlay.base = base;
+
+    *dev = (block_device_t) {
+        .ctx = &overlay,
+        .block_count = base->block_count,
+        .optimal_blocks = base->optimal_blocks,
+        .read = overlay_read,
+        .write = overlay_write,
+        .revert = overlay_revert,
+    };
+
+    overlay_revert(dev);
+}
@@ -0,0 +1,45 @@
+#ifndef OVERLAY_H
+#define OVERLAY_H
+
+#include "block_device.h"
+
+/**
+ * Copy-on-write overlay for a read-only base medium. Writes land in a pool of SRAM sectors and
+ * reads check the pool before falling through to the base, so the base image is never touched.
+ * Reverting the overlay (SCSI vendor command or the SW0 button) drops every written sector at
+ * once and the drive goes back to its factory contents.
+ *
+ * OVERLAY_BLOCKS sectors of SRAM are set aside for the pool. Once it's full, writes to sectors that
+ * aren't already in the overlay fail with a WRITE ERROR.
+ */
+#ifndef OVERLAY_BLOCKS
+#define OVERLAY_BLOCKS 16
+#endif
+
+/**
+ * The remap table is an open-addressed hash from LBA to pool slot. It's kept at least twice the
+ * size of the pool so that linear probe chains stay short.
+ */
+#if (OVERLAY_BLOCKS <= 16)
+#define OVERLAY_HASH_BITS 5
+#elif (OVERLAY_BLOCKS <= 32)
+#define OVERLAY_HASH_BITS 6
+#elif (OVERLAY_BLOCKS <= 64)
+#define OVERLAY_HASH_BITS 7
+#elif (OVERLAY_BLOCKS <= 128)
+#define OVERLAY_HASH_BITS 8
+#elif (OVERLAY_BLOCKS <= 255)
+#define OVERLAY_HASH_BITS 9
+#else
+#error "OVERLAY_BLOCKS must be 255 or less"
+#endif
+
+#define OVERLAY_HASH_SIZE (1 << OVERLAY_HASH_BITS)
+
+/**
+ * Fills in dev so that it's an overlay on top of base. base has to stay around for as long as dev
+ * does.
+ */
+void overlay_init(block_device_t *dev, const block_device_t *base);
+
+#endif
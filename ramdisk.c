@@ -0,0 +1,110 @@
+#include "ramdisk.h"
+
+#include "dmac.h"
+
+#include <string.h>
+
+static uint8_t ramdisk_space[RAMDISK_BLOCKS][BLOCK_DEVICE_BLOCK_SIZE] __attribute__((aligned(4)));
+
+// one bit per block; clear bits are unmapped and read back as zeros without touching the disk.
+static uint32_t ramdisk_mapped[(RAMDISK_BLOCKS + 31) / 32];
+
+// CRC of each mapped block as computed by the DMAC on the way in, checked against the CRC of the
+// copy on the way out.
+static uint32_t ramdisk_crc[RAMDISK_BLOCKS];
+
+/**
+ * Boot sector for a tiny FAT12 volume: 512 byte sectors, 1 sector per cluster, 1 reserved sector,
+ * 2 FATs of 1 sector each and a 1 sector root directory. One FAT sector covers 341 clusters, which
+ * is plenty for anything that fits in SRAM.
+ */
+static const uint8_t ramdisk_boot_sector[] =
+{
+    0xeb, 0x3c, 0x90,                           // jump instruction
+    'M', 'S', 'D', 'O', 'S', '5', '.', '0',     // OEM name
+    0x00, 0x02,                                 // bytes per sector
+    1,                                          // sectors per cluster
+    0x01, 0x00,                                 // reserved sectors
+    2,                                          // number of FATs
+    0x10, 0x00,                                 // root directory entries
+    RAMDISK_BLOCKS & 0xff, RAMDISK_BLOCKS >> 8, // total sectors
+    0xf8,                                       // media descriptor: fixed disk
+    0x01, 0x00,                                 // sectors per FAT
+    0x01, 0x00,                                 // sectors per track
+    0x01, 0x00,                                 // number of heads
+    0x00, 0x00, 0x00, 0x00,                     // hidden sectors
+    0x00, 0x00, 0x00, 0x00,                     // total sectors (32 bit)
+    0x80,                                       // drive number
+    0x00,
+    0x29,                                       // extended boot signature
+    0x26, 0x00, 0x00, 0x00,                     // volume id
+    'R', 'A', 'M', 'D', 'I', 'S', 'K', ' ', ' ', ' ', ' ',
+    'F', 'A', 'T', '1', '2', ' ', ' ', ' '
+};
+
+static const uint8_t ramdisk_fat_head[] = { 0xf8, 0xff, 0xff };
+
+static const uint8_t ramdisk_volume_label[] =
+{
+    'R', 'A', 'M', 'D', 'I', 'S', 'K', ' ', ' ', ' ', ' ',
+    0x08                                        // attribute: volume label
+};
+
+static int ramdisk_read(const block_device_t *dev, uint32_t lba, uint8_t *buf)
+{
+    if (ramdisk_mapped[lba >> 5] & (1u << (lba & 31))) {
+        if (dmac_copy_crc32(buf, ramdisk_space[lba], BLOCK_DEVICE_BLOCK_SIZE) != ramdisk_crc[lba]) {
+            return 1;
+        }
+    } else {
+        memset(buf, 0, BLOCK_DEVICE_BLOCK_SIZE);
+    }
+    return 0;
+}
+
+static int ramdisk_write(const block_device_t *dev, uint32_t lba, const uint8_t *buf)
+{
+    ramdisk_crc[lba] = dmac_copy_crc32(ramdisk_space[lba], buf, BLOCK_DEVICE_BLOCK_SIZE);
+    ramdisk_mapped[lba >> 5] |= (1u << (lba & 31));
+    return 0;
+}
+
+static int ramdisk_unmap(const block_device_t *dev, uint32_t lba, uint32_t count)
+{
+    for (; count; count--, lba++) {
+        ramdisk_mapped[lba >> 5] &= ~(1u << (lba & 31));
+    }
+    return 0;
+}
+
+void ramdisk_init(block_device_t *dev)
+{
+    memset(ramdisk_space, 0, sizeof(ramdisk_space));
+
+    memcpy(ramdisk_space[0], ramdisk_boot_sector, sizeof(ramdisk_boot_sector));
+    ramdisk_space[0][510] = 0x55;
+    ramdisk_space[0][511] = 0xaa;
+
+    // both FATs, then the root directory
+    memcpy(ramdisk_space[1], ramdisk_fat_head, sizeof(ramdisk_fat_head));
+    memcpy(ramdisk_space[2], ramdisk_fat_head, sizeof(ramdisk_fat_head));
+    memcpy(ramdisk_space[3], ramdisk_volume_label, sizeof(ramdisk_volume_label));
+
+    // boot sector, FATs and root directory
+    memset(ramdisk_mapped, 0, sizeof(ramdisk_mapped));
+    ramdisk_mapped[0] = 0x0f;
+    for (int i = 0; i < 4; i++) {
+        // copying a block onto itself just checksums it
+        ramdisk_crc[i] = dmac_copy_crc32(ramdisk_space[i], ramdisk_space[i],
+                                         BLOCK_DEVICE_BLOCK_SIZE);
+    }
+
+    *dev = (block_device_t) {
+        .ctx = ramdisk_space,
+        .block_count = RAMDISK_BLOCKS,
+        .optimal_blocks = 1,
+        .read = ramdisk_read,
+        .write = ramdisk_write,
+        .unmap = ramdisk_unmap,
+    };
+}
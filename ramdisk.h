@@ -0,0 +1,22 @@
+#ifndef RAMDISK_H
+#define RAMDISK_H
+
+#include "block_device.h"
+
+/**
+ * A RAM disk carved out of SRAM. It's a zero-latency medium, which makes it useful for measuring
+ * how fast the USB and SCSI layers can go on their own.
+ *
+ * The size is picked at build time; see RAMDISK_BLOCKS in the Makefile. SRAM is tight, so making
+ * it bigger means shrinking STACK_SIZE and SERCOM3_TX_BUF_SIZE to match.
+ */
+#ifndef RAMDISK_BLOCKS
+#define RAMDISK_BLOCKS 40
+#endif
+
+/**
+ * Lays down a blank FAT12 volume and fills in dev so that it points at the RAM disk.
+ */
+void ramdisk_init(block_device_t *dev);
+
+#endif
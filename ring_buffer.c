@@ -0,0 +1,78 @@
+#include "ring_buffer.h"
+
+#include <string.h>
+
+// The M0+ doesn't reorder memory accesses, but the compiler might, and the other side of the ring
+// may be a DMA channel rather than code. Index updates are fenced off from the data they publish.
+#if defined(__arm__)
+#define RING_BUFFER_BARRIER() __asm__ __volatile__ ("dmb" ::: "memory")
+#else
+#define RING_BUFFER_BARRIER() __sync_synchronize()
+#endif
+
+void ring_buffer_init(ring_buffer_t *rb, uint8_t *space, uint32_t size)
+{
+    rb->data = space;
+    rb->mask = size - 1;
+    rb->head = 0;
+    rb->tail = 0;
+}
+
+uint32_t ring_buffer_write_span(const ring_buffer_t *rb, uint8_t **span)
+{
+    const uint32_t head = rb->head;
+    const uint32_t free = (rb->mask + 1) - (head - rb->tail);
+    const uint32_t to_end = (rb->mask + 1) - (head & rb->mask);
+
+    *span = &rb->data[head & rb->mask];
+    return (free < to_end) ? free : to_end;
+}
+
+void ring_buffer_write_commit(ring_buffer_t *rb, uint32_t n)
+{
+    // the data has to land before the consumer can see it
+    RING_BUFFER_BARRIER();
+    rb->head += n;
+}
+
+uint32_t ring_buffer_free(const ring_buffer_t *rb)
+{
+    return (rb->mask + 1) - (rb->head - rb->tail);
+}
+
+uint32_t ring_buffer_write(ring_buffer_t *rb, const uint8_t *data, uint32_t len)
+{
+    uint32_t written = 0;
+
+    // at most two spans: up to the end of the storage, then from the start
+    for (int i = 0; (i < 2) && (written < len); i++) {
+        uint8_t *span;
+        uint32_t n = ring_buffer_write_span(rb, &span);
+        if (n > (len - written)) {
+            n = len - written;
+        }
+        memcpy(span, &data[written], n);
+        ring_buffer_write_commit(rb, n);
+        written += n;
+    }
+    return written;
+}
+
+uint32_t ring_buffer_read_span(const ring_buffer_t *rb, const uint8_t **span)
+{
+    const uint32_t tail = rb->tail;
+    const uint32_t used = rb->head - tail;
+    const uint32_t to_end = (rb->mask + 1) - (tail & rb->mask);
+
+    // don't let reads of the data get ahead of the read of head
+    RING_BUFFER_BARRIER();
+    *span = &rb->data[tail & rb->mask];
+    return (used < to_end) ? used : to_end;
+}
+
+void ring_buffer_read_commit(ring_buffer_t *rb, uint32_t n)
+{
+    // finish with the data before the producer can reuse it
+    RING_BUFFER_BARRIER();
+    rb->tail += n;
+}
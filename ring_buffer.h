@@ -0,0 +1,65 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <stdint.h>
+
+/**
+ * Single-producer / single-consumer byte ring. The producer only ever writes head and the consumer
+ * only ever writes tail, so as long as there's exactly one of each (e.g. one interrupt handler
+ * filling the ring and another draining it) neither side needs to lock out the other.
+ *
+ * head and tail count bytes written and read since init and are allowed to wrap; the storage size
+ * is a power of two, so head - tail is always the fill level and masking either one gives its
+ * offset in the storage. The whole storage can be used.
+ *
+ * Both sides work in spans: a span is a contiguous stretch of the storage (it stops at the end and
+ * picks up at the start on the next call) that can be filled or drained with memcpy or a DMA
+ * channel, then handed over with a commit.
+ */
+typedef struct ring_buffer
+{
+    uint8_t *data;
+    uint32_t mask;
+
+    volatile uint32_t head;
+    volatile uint32_t tail;
+} ring_buffer_t;
+
+/**
+ * size must be a power of two.
+ */
+void ring_buffer_init(ring_buffer_t *rb, uint8_t *space, uint32_t size);
+
+/**
+ * Producer side. Points *span at the next free bytes and returns how many are contiguous. Nothing
+ * in the span is visible to the consumer until ring_buffer_write_commit.
+ */
+uint32_t ring_buffer_write_span(const ring_buffer_t *rb, uint8_t **span);
+
+/**
+ * Producer side. Publishes the first n bytes of the last write span.
+ */
+void ring_buffer_write_commit(ring_buffer_t *rb, uint32_t n);
+
+/**
+ * Producer side. How many bytes could be written right now. The consumer only ever frees more.
+ */
+uint32_t ring_buffer_free(const ring_buffer_t *rb);
+
+/**
+ * Producer side. Copies in as much of data as fits and returns how many bytes that was.
+ */
+uint32_t ring_buffer_write(ring_buffer_t *rb, const uint8_t *data, uint32_t len);
+
+/**
+ * Consumer side. Points *span at the oldest bytes and returns how many are contiguous. They stay
+ * in the ring until ring_buffer_read_commit, so they can be sent straight out of the storage.
+ */
+uint32_t ring_buffer_read_span(const ring_buffer_t *rb, const uint8_t **span);
+
+/**
+ * Consumer side. Releases the first n bytes of the last read span back to the producer.
+ */
+void ring_buffer_read_commit(ring_buffer_t *rb, uint32_t n);
+
+#endif
@@ -0,0 +1,121 @@
+#include "romdisk.h"
+
+#include <string.h>
+
+typedef struct romdisk_header
+{
+    uint32_t magic;
+    uint32_t block_count;
+    uint32_t index[];
+} romdisk_header_t;
+
+extern const uint8_t romdisk_image[];
+
+/**
+ * Adds a run of extra length bytes at *src to *len: 255 means another byte follows. Returns nonzero
+ * if the run doesn't end before src_end.
+ */
+static int romdisk_length(const uint8_t **src, const uint8_t *src_end, uint32_t *len)
+{
+    uint8_t b;
+    do {
+        if (*src >= src_end) {
+            return 1;
+        }
+        b = *(*src)++;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+/**
+ * Decompresses one sector. A full-speed bulk pipe moves a sector about every 420us, ~20k cycles at
+ * 48MHz, and this has to fit well inside that; tests/bench_romdisk times it on the host.
+ *
+ * Returns nonzero if the compressed data is corrupt.
+ */
+static int romdisk_inflate(const uint8_t *src, uint32_t src_len, uint8_t *dst)
+{
+    const uint8_t *const src_end = src + src_len;
+    uint8_t *op = dst;
+    uint8_t *const op_end = dst + BLOCK_DEVICE_BLOCK_SIZE;
+
+    while (src < src_end) {
+        const uint8_t token = *src++;
+
+        // literals (src never gets past src_end, so the differences below can't go negative)
+        uint32_t len = token >> 4;
+        if ((len == 15) && romdisk_length(&src, src_end, &len)) {
+            return 1;
+        }
+        if ((len > (uint32_t)(op_end - op)) || (len > (uint32_t)(src_end - src))) {
+            return 1;
+        }
+        memcpy(op, src, len);
+        op += len;
+        src += len;
+
+        // the last sequence is literals only
+        if (src >= src_end) {
+            break;
+        }
+
+        // match
+        if ((src_end - src) < 2) {
+            return 1;
+        }
+        const uint32_t offset = src[0] | (src[1] << 8);
+        src += 2;
+
+        len = (token & 0x0f) + 4;
+        if (((token & 0x0f) == 15) && romdisk_length(&src, src_end, &len)) {
+            return 1;
+        }
+        if ((offset == 0) || (offset > (uint32_t)(op - dst)) || (len > (uint32_t)(op_end - op))) {
+            return 1;
+        }
+
+        // byte at a time on purpose: matches are allowed to overlap their own output.
+        const uint8_t *match = op - offset;
+        while (len--) {
+            *op++ = *match++;
+        }
+    }
+
+    return (op != op_end);
+}
+
+static int romdisk_read(const block_device_t *dev, uint32_t lba, uint8_t *buf)
+{
+    const romdisk_header_t *hdr = dev->ctx;
+    const uint8_t *data = (const uint8_t *)&hdr->index[hdr->block_count + 1];
+    const uint32_t start = hdr->index[lba];
+    const uint32_t len = hdr->index[lba + 1] - start;
+
+    if (len == 0) {
+        memset(buf, 0, BLOCK_DEVICE_BLOCK_SIZE);
+        return 0;
+    } else if (len == BLOCK_DEVICE_BLOCK_SIZE) {
+        memcpy(buf, &data[start], BLOCK_DEVICE_BLOCK_SIZE);
+        return 0;
+    } else {
+        return romdisk_inflate(&data[start], len, buf);
+    }
+}
+
+void romdisk_init(block_device_t *dev)
+{
+    const romdisk_header_t *hdr = (const romdisk_header_t *)romdisk_image;
+
+    *dev = (block_device_t) {
+        .ctx = (void *)hdr,
+        .block_count = (hdr->magic == ROMDISK_MAGIC) ? hdr->block_count : 0,
+        .read = romdisk_read,
+    };
+
+    // The host reads files a cluster at a time anyway; the boot sector says how big that is.
+    uint8_t boot[BLOCK_DEVICE_BLOCK_SIZE];
+    if (dev->block_count && (romdisk_read(dev, 0, boot) == 0)) {
+        dev->optimal_blocks = boot[13];
+    }
+}
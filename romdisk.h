@@ -0,0 +1,26 @@
+#ifndef ROMDISK_H
+#define ROMDISK_H
+
+#include "block_device.h"
+
+/**
+ * A read-only disk whose contents are baked into flash by tools/mkromdisk.py. Every sector is
+ * compressed on its own, so any LBA can be served by decompressing just that sector straight into
+ * the SCSI layer's block buffer.
+ *
+ * The image is linked in as romdisk_image[] and looks like:
+ *     uint32_t magic             "RDSK"
+ *     uint32_t block_count
+ *     uint32_t index[block_count + 1]
+ *     uint8_t  data[]
+ * See tools/mkromdisk.py for the compressed sector format.
+ */
+#define ROMDISK_MAGIC 0x4b534452
+
+/**
+ * Fills in dev so that it points at the ROM disk. The device has no write function, so the SCSI
+ * layer reports it as write protected.
+ */
+void romdisk_init(block_device_t *dev);
+
+#endif
@@ -1,12 +1,17 @@
 #include "scsi.h"
 
+#include "latency.h"
+#include "mtb.h"
+#include "serial_number.h"
+#include "stats.h"
+
 #include <string.h>
 
 static const uint8_t scsi_inquiry_response[] =
 {
     0,      // direct access block type
     0x80,   // device is "removable"
-    4,      // SPC-2 compliance
+    5,      // SPC-3 compliance
     2,      // responce data format
     0x20,   // remaining response length
     0,      // additional fields
@@ -17,12 +22,646 @@ static const uint8_t scsi_inquiry_response[] =
     '0', '0', '0', '1'
 };
 
-// NB: big endian???
-static const uint8_t scsi_capacity[] =
+// SCSI fields are all big endian.
+static uint32_t scsi_get_be32(const uint8_t *p)
 {
-    0x00, 0x00, 0x07, 0xff,   // 2048 blocks
-    0x00, 0x00, 0x02, 0x00    // 512  bytes per block
-};
+    return (((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3]);
+}
+
+static uint16_t scsi_get_be16(const uint8_t *p)
+{
+    return (((uint16_t)p[0] << 8) | p[1]);
+}
+
+static void scsi_put_be16(uint8_t *p, uint16_t x)
+{
+    p[0] = x >> 8;
+    p[1] = x;
+}
+
+static void scsi_put_be32(uint8_t *p, uint32_t x)
+{
+    p[0] = x >> 24;
+    p[1] = x >> 16;
+    p[2] = x >> 8;
+    p[3] = x;
+}
+
+static void scsi_set_sense(scsi_state_t *state, uint8_t key, uint8_t asc, uint8_t ascq)
+{
+    state->lun->sense_key = key;
+    state->lun->sense_asc = asc;
+    state->lun->sense_ascq = ascq;
+    state->lun->sense_info_valid = 0;
+}
+
+/**
+ * Points the sense data's INFORMATION field at the logical block containing medium block lba,
+ * which caused the error.
+ */
+static void scsi_set_sense_lba(scsi_state_t *state, uint32_t lba)
+{
+    state->lun->sense_info = lba >> state->lun->block_shift;
+    state->lun->sense_info_valid = 1;
+}
+
+static uint32_t scsi_logical_block_count(const scsi_lun_t *lun)
+{
+    return lun->bdev->block_count >> lun->block_shift;
+}
+
+static uint32_t scsi_logical_block_size(const scsi_lun_t *lun)
+{
+    return BLOCK_DEVICE_BLOCK_SIZE << lun->block_shift;
+}
+
+/**
+ * Fills in_buf with a CSW for the current command. Returns the number of bytes in a CSW.
+ */
+static int32_t scsi_fill_csw(scsi_state_t *state, uint8_t *in_buf)
+{
+    memcpy(state->csw.csw_signature, "USBS", 4);
+    state->csw.csw_tag = state->cbw.cbw_tag;
+    state->csw.csw_data_residue = state->data_stage_bytes_remaining;
+    memcpy(in_buf, &(state->csw), 13);
+    latency_csw();
+    MTB_COMMAND_END();
+    return 13;
+}
+
+/**
+ * Queues a short, fixed response (INQUIRY data, capacity, sense...) as the whole data IN stage.
+ */
+static int32_t scsi_send_response(scsi_state_t *state, const uint8_t *response, int32_t len,
+                                  uint8_t *in_buf)
+{
+    int32_t bytes_to_send = len;
+    if (state->cbw.cbw_data_transfer_length < len) {
+        bytes_to_send = state->cbw.cbw_data_transfer_length;
+    }
+
+    memcpy(in_buf, response, bytes_to_send);
+    state->data_stage_bytes_remaining -= bytes_to_send;
+    state->current_state = CBW_FLOW_DATA_IN_PENDING_STATE;
+    latency_data();
+    return bytes_to_send;
+}
+
+/**
+ * Fails the current command with CHECK CONDITION. How the data stage gets cut short depends on
+ * which way it was going: an IN pipe gets STALLed (the CSW goes out once the host clears the
+ * STALL), OUT data gets swallowed, and if there's no data stage left the CSW goes out right away.
+ */
+static int32_t scsi_fail(scsi_state_t *state, uint8_t *in_buf,
+                         uint8_t key, uint8_t asc, uint8_t ascq)
+{
+    scsi_set_sense(state, key, asc, ascq);
+    state->csw.csw_status = 1;
+    state->blocks_remaining = 0;
+
+    if (state->data_stage_bytes_remaining <= 0) {
+        state->current_state = CBW_FLOW_CSW_PENDING_STATE;
+        return scsi_fill_csw(state, in_buf);
+    } else if (state->cbw.cbw_flags & USB_MASS_STORAGE_CBW_FLAG_IN) {
+        state->current_state = CBW_FLOW_DATA_IN_PENDING_STATE;
+        return -2;
+    } else {
+        state->current_state = CBW_FLOW_EXPECTING_DATA_OUT_STATE;
+        return -1;
+    }
+}
+
+/**
+ * Pulls the next packet of a READ out of the medium, fetching a new block whenever the last one
+ * has been used up.
+ */
+static int32_t scsi_read_packet(scsi_state_t *state, uint8_t *in_buf)
+{
+    if (state->block_offset == BLOCK_DEVICE_BLOCK_SIZE) {
+        if ((state->blocks_remaining == 0) || (state->data_stage_bytes_remaining <= 0)) {
+            // the host asked for more than the CDB did; STALL and let the CSW carry the residue.
+            state->current_state = CBW_FLOW_DATA_IN_PENDING_STATE;
+            return -2;
+        }
+
+        if (state->lun->bdev->read(state->lun->bdev, state->lba, state->block_buf)) {
+            const int32_t ret = scsi_fail(state, in_buf, SCSI_SENSE_KEY_MEDIUM_ERROR,
+                                          SCSI_ASC_UNRECOVERED_READ_ERROR, 0);
+            scsi_set_sense_lba(state, state->lba);
+            return ret;
+        }
+        state->lba++;
+        state->blocks_remaining--;
+        state->block_offset = 0;
+        stats.bytes_read += BLOCK_DEVICE_BLOCK_SIZE;
+    }
+
+    int32_t bytes_to_send = USB_BULK_PACKET_SIZE;
+    if (state->data_stage_bytes_remaining < bytes_to_send) {
+        bytes_to_send = state->data_stage_bytes_remaining;
+    }
+
+    memcpy(in_buf, &state->block_buf[state->block_offset], bytes_to_send);
+    state->block_offset += bytes_to_send;
+    state->data_stage_bytes_remaining -= bytes_to_send;
+    latency_data();
+
+    if (state->data_stage_bytes_remaining == 0) {
+        state->current_state = CBW_FLOW_DATA_IN_PENDING_STATE;
+    } else {
+        state->current_state = CBW_FLOW_DATA_IN_STATE;
+    }
+
+    return bytes_to_send;
+}
+
+/**
+ * Queues a response of up to BLOCK_DEVICE_BLOCK_SIZE bytes, already built at the end of block_buf,
+ * as the whole data IN stage. It goes out a packet at a time like READ data, and if the host asked
+ * for more, the pipe is STALLed and the CSW carries the residue.
+ */
+static int32_t scsi_send_block_buf_tail(scsi_state_t *state, uint32_t len, uint8_t *in_buf)
+{
+    if (state->data_stage_bytes_remaining <= 0) {
+        state->current_state = CBW_FLOW_CSW_PENDING_STATE;
+        return scsi_fill_csw(state, in_buf);
+    }
+
+    state->blocks_remaining = 0;
+    state->block_offset = BLOCK_DEVICE_BLOCK_SIZE - len;
+    return scsi_read_packet(state, in_buf);
+}
+
+/**
+ * Accumulates one packet of WRITE data, handing whole blocks down to the medium as they fill up.
+ * Data that arrives after the command has failed (or past the end of the CDB's range) is thrown
+ * away; the CSW reports the failure.
+ */
+static void scsi_write_packet(scsi_state_t *state, const uint8_t *out_buf, uint8_t nbytes)
+{
+    state->data_stage_bytes_remaining -= nbytes;
+
+    if ((state->blocks_remaining == 0) || (state->csw.csw_status != 0)) {
+        return;
+    }
+
+    uint32_t space = BLOCK_DEVICE_BLOCK_SIZE - state->block_offset;
+    if (nbytes > space) {
+        nbytes = space;
+    }
+
+    memcpy(&state->block_buf[state->block_offset], out_buf, nbytes);
+    state->block_offset += nbytes;
+
+    if (state->block_offset == BLOCK_DEVICE_BLOCK_SIZE) {
+        if (state->lun->bdev->write(state->lun->bdev, state->lba, state->block_buf)) {
+            scsi_set_sense(state, SCSI_SENSE_KEY_MEDIUM_ERROR, SCSI_ASC_WRITE_ERROR, 0);
+            state->csw.csw_status = 1;
+        } else {
+            stats.bytes_written += BLOCK_DEVICE_BLOCK_SIZE;
+        }
+        state->lba++;
+        state->blocks_remaining--;
+        state->block_offset = 0;
+    }
+}
+
+/**
+ * The most logical blocks WRITE SAME or VERIFY can cover (see SCSI_ISR_BLOCKS_MAX).
+ */
+static uint32_t scsi_isr_block_limit(const scsi_lun_t *lun)
+{
+    return SCSI_ISR_BLOCKS_MAX >> lun->block_shift;
+}
+
+/**
+ * Builds VPD page `page` in buf (which must be at least USB_BULK_PACKET_SIZE bytes). Returns the
+ * length of the page, or -1 if it isn't supported.
+ */
+static int32_t scsi_inquiry_vpd(const scsi_state_t *state, uint8_t page, uint8_t *buf)
+{
+    const block_device_t *bdev = state->lun->bdev;
+    const uint32_t block_count = scsi_logical_block_count(state->lun);
+    int32_t len;
+
+    memset(buf, 0, USB_BULK_PACKET_SIZE);
+    buf[1] = page;
+    switch (page) {
+        case SCSI_VPD_SUPPORTED_PAGES: {
+            // in ascending order
+            len = 4;
+            buf[len++] = SCSI_VPD_SUPPORTED_PAGES;
+            buf[len++] = SCSI_VPD_UNIT_SERIAL_NUMBER;
+            buf[len++] = SCSI_VPD_DEVICE_IDENTIFICATION;
+            buf[len++] = SCSI_VPD_BLOCK_LIMITS;
+            buf[len++] = SCSI_VPD_BLOCK_DEVICE_CHARACTERISTICS;
+            if (bdev->unmap) {
+                buf[len++] = SCSI_VPD_LOGICAL_BLOCK_PROVISIONING;
+            }
+            break;
+        }
+
+        case SCSI_VPD_UNIT_SERIAL_NUMBER: {
+            serial_number_hex((char *)&buf[4]);
+            len = 4 + SERIAL_NUMBER_HEX_LEN;
+            break;
+        }
+
+        case SCSI_VPD_DEVICE_IDENTIFICATION: {
+            // A single T10 vendor ID based designator: the INQUIRY vendor ID followed by the
+            // serial number.
+            uint8_t *d = &buf[4];
+            d[0] = 0x02;        // code set: ASCII
+            d[1] = 0x01;        // association: logical unit, designator type: T10 vendor ID
+            d[3] = 8 + SERIAL_NUMBER_HEX_LEN;
+            memcpy(&d[4], &scsi_inquiry_response[8], 8);
+            serial_number_hex((char *)&d[12]);
+            len = 4 + 4 + d[3];
+            break;
+        }
+
+        case SCSI_VPD_BLOCK_LIMITS: {
+            // Ask for transfers sized and aligned to the medium's erase unit or cluster, and cap
+            // them at the largest whole number of those that one CBW can carry; its transfer
+            // length is a signed 32 bit byte count.
+            const uint32_t optimal = bdev->optimal_blocks >> state->lun->block_shift;
+            const uint32_t unit = optimal ? optimal : 1;
+            const uint32_t cbw_max = 0x7fffffff >> (BLOCK_DEVICE_BLOCK_SHIFT +
+                                                    state->lun->block_shift);
+            const uint32_t max = (block_count < cbw_max) ? block_count : cbw_max;
+
+            len = 0x40;
+            buf[4] = 0x01;      // WSNZ: WRITE SAME needs a nonzero block count
+            scsi_put_be16(&buf[6], unit);                               // transfer granularity
+            scsi_put_be32(&buf[8], (max / unit) * unit);                // max transfer length
+            scsi_put_be32(&buf[12], unit);                              // optimal transfer length
+            if (bdev->unmap) {
+                scsi_put_be32(&buf[20], block_count);                   // max unmap LBA count
+                scsi_put_be32(&buf[24], SCSI_UNMAP_MAX_DESCRIPTORS);    // max unmap descriptors
+                scsi_put_be32(&buf[28], 1);                             // optimal unmap granularity
+            }
+            scsi_put_be32(&buf[40], scsi_isr_block_limit(state->lun));  // max WRITE SAME length
+            break;
+        }
+
+        case SCSI_VPD_BLOCK_DEVICE_CHARACTERISTICS: {
+            len = 0x40;
+            scsi_put_be16(&buf[4], 0x0001);     // medium rotation rate: non-rotating (solid state)
+            break;
+        }
+
+        case SCSI_VPD_LOGICAL_BLOCK_PROVISIONING: {
+            if (bdev->unmap == 0) {
+                return -1;
+            }
+            len = 8;
+            buf[5] = 0x80 |     // LBPU: UNMAP is supported
+                     0x40 |     // LBPWS: WRITE SAME(16) with UNMAP is supported
+                     0x20 |     // LBPWS10: so is WRITE SAME(10)
+                     0x04;      // LBPRZ: unmapped blocks read back as zeros
+            buf[6] = 0x02;      // thin provisioned
+            break;
+        }
+
+        default: {
+            return -1;
+        }
+    }
+
+    scsi_put_be16(&buf[2], len - 4);
+    return len;
+}
+
+/**
+ * Collects a data-out parameter list (e.g. UNMAP's block descriptors) into block_buf. Anything past
+ * the size of block_buf is dropped.
+ */
+static void scsi_collect_parameters(scsi_state_t *state, const uint8_t *out_buf, uint8_t nbytes)
+{
+    state->data_stage_bytes_remaining -= nbytes;
+
+    if (state->csw.csw_status != 0) {
+        return;
+    }
+
+    uint32_t space = BLOCK_DEVICE_BLOCK_SIZE - state->block_offset;
+    if (nbytes > space) {
+        nbytes = space;
+    }
+    memcpy(&state->block_buf[state->block_offset], out_buf, nbytes);
+    state->block_offset += nbytes;
+}
+
+/**
+ * Collects WRITE SAME's one logical block of data. Only the first medium block's worth fits in
+ * block_buf, so when logical blocks are bigger than that, the rest of the data has to repeat it
+ * (which the usual all-zeros pattern does); anything else fails the command.
+ */
+static void scsi_collect_pattern(scsi_state_t *state, const uint8_t *out_buf, uint8_t nbytes)
+{
+    const uint32_t logical_size = BLOCK_DEVICE_BLOCK_SIZE << state->lun->block_shift;
+
+    state->data_stage_bytes_remaining -= nbytes;
+
+    for (; nbytes && (state->block_offset < logical_size); nbytes--, out_buf++) {
+        if (state->csw.csw_status != 0) {
+            return;
+        }
+
+        const uint32_t i = state->block_offset & (BLOCK_DEVICE_BLOCK_SIZE - 1);
+        if (state->block_offset < BLOCK_DEVICE_BLOCK_SIZE) {
+            state->block_buf[i] = *out_buf;
+        } else if (state->block_buf[i] != *out_buf) {
+            scsi_set_sense(state, SCSI_SENSE_KEY_ILLEGAL_REQUEST,
+                           SCSI_ASC_INVALID_FIELD_IN_PARAMETER_LIST, 0);
+            state->csw.csw_status = 1;
+        }
+        state->block_offset++;
+    }
+}
+
+/**
+ * Carries out an UNMAP whose parameter list has been collected in block_buf. Every descriptor is
+ * range checked before any of them are passed down, so a bad list doesn't half-happen.
+ */
+static void scsi_unmap(scsi_state_t *state)
+{
+    const uint8_t *p = state->block_buf;
+    const block_device_t *bdev = state->lun->bdev;
+    const uint8_t shift = state->lun->block_shift;
+    const uint32_t block_count = bdev->block_count >> shift;
+
+    if (state->block_offset < 8) {
+        return;
+    }
+
+    uint32_t desc_len = scsi_get_be16(&p[2]);
+    if (desc_len > (state->block_offset - 8)) {
+        desc_len = state->block_offset - 8;
+    }
+    const uint8_t *const end = &p[8 + (desc_len & ~0x0f)];
+
+    for (const uint8_t *d = &p[8]; d < end; d += 16) {
+        const uint32_t lba = scsi_get_be32(&d[4]);
+        const uint32_t count = scsi_get_be32(&d[8]);
+        if (scsi_get_be32(&d[0]) || (lba > block_count) || (count > (block_count - lba))) {
+            scsi_set_sense(state, SCSI_SENSE_KEY_ILLEGAL_REQUEST, SCSI_ASC_LBA_OUT_OF_RANGE, 0);
+            state->csw.csw_status = 1;
+            return;
+        }
+    }
+
+    for (const uint8_t *d = &p[8]; d < end; d += 16) {
+        const uint32_t count = scsi_get_be32(&d[8]) << shift;
+        if (count && bdev->unmap(bdev, scsi_get_be32(&d[4]) << shift, count)) {
+            scsi_set_sense(state, SCSI_SENSE_KEY_MEDIUM_ERROR, SCSI_ASC_WRITE_ERROR, 0);
+            state->csw.csw_status = 1;
+            return;
+        }
+    }
+}
+
+/**
+ * Range checks a transfer of logical blocks and sets up the data stage bookkeeping in medium
+ * blocks. Returns nonzero if the range falls off the end of the medium. lba_hi is the top half of
+ * a 64 bit LBA; the medium's block count is only 32 bits, so anything there is out of range.
+ */
+static int scsi_setup_transfer(scsi_state_t *state, uint32_t lba_hi, uint32_t lba,
+                               uint32_t nblocks)
+{
+    const uint32_t block_count = scsi_logical_block_count(state->lun);
+
+    state->lba = lba << state->lun->block_shift;
+    state->blocks_remaining = 0;
+    if (lba_hi || (lba > block_count) || (nblocks > (block_count - lba))) {
+        return 1;
+    }
+
+    state->blocks_remaining = nblocks << state->lun->block_shift;
+    return 0;
+}
+
+/**
+ * READ(10), WRITE(10), VERIFY(10), WRITE SAME(10): 32 bit LBA at byte 2, 16 bit length at byte 7.
+ */
+static int scsi_setup_transfer_10(scsi_state_t *state)
+{
+    return scsi_setup_transfer(state, 0,
+                               scsi_get_be32(&state->cbw.cbwcb[2]),
+                               scsi_get_be16(&state->cbw.cbwcb[7]));
+}
+
+/**
+ * READ(16), WRITE(16), WRITE SAME(16): 64 bit LBA at byte 2, 32 bit length at byte 10.
+ */
+static int scsi_setup_transfer_16(scsi_state_t *state)
+{
+    return scsi_setup_transfer(state,
+                               scsi_get_be32(&state->cbw.cbwcb[2]),
+                               scsi_get_be32(&state->cbw.cbwcb[6]),
+                               scsi_get_be32(&state->cbw.cbwcb[10]));
+}
+
+/**
+ * Carries out a WRITE SAME once its one block of data is in block_buf. Zeros on a medium that can
+ * unmap are just an unmap, so no blocks actually get written. Unmapped blocks read back as zeros
+ * (LBPRZ), so that's done whether or not the host set the UNMAP bit. Discarding more than
+ * SCSI_ISR_BLOCKS_MAX at once is what UNMAP is for.
+ */
+static void scsi_write_same(scsi_state_t *state)
+{
+    const block_device_t *bdev = state->lun->bdev;
+
+    if (bdev->unmap && block_device_is_zero(state->block_buf)) {
+        if (bdev->unmap(bdev, state->lba, state->blocks_remaining)) {
+            scsi_set_sense(state, SCSI_SENSE_KEY_MEDIUM_ERROR, SCSI_ASC_WRITE_ERROR, 0);
+            state->csw.csw_status = 1;
+        }
+        return;
+    }
+
+    for (; state->blocks_remaining; state->blocks_remaining--, state->lba++) {
+        if (bdev->write(bdev, state->lba, state->block_buf)) {
+            scsi_set_sense(state, SCSI_SENSE_KEY_MEDIUM_ERROR, SCSI_ASC_WRITE_ERROR, 0);
+            state->csw.csw_status = 1;
+            return;
+        }
+    }
+}
+
+/**
+ * VERIFY with BYTCHK=0: every block in the range is read back through the medium, which checks it
+ * against its stored checksum, and nothing crosses the bus but the CBW and CSW. The first bad block
+ * fails the command with its LBA in the sense data.
+ */
+static void scsi_verify(scsi_state_t *state)
+{
+    const block_device_t *bdev = state->lun->bdev;
+
+    for (; state->blocks_remaining; state->blocks_remaining--, state->lba++) {
+        if (bdev->read(bdev, state->lba, state->block_buf)) {
+            scsi_set_sense(state, SCSI_SENSE_KEY_MEDIUM_ERROR, SCSI_ASC_UNRECOVERED_READ_ERROR, 0);
+            scsi_set_sense_lba(state, state->lba);
+            state->csw.csw_status = 1;
+            return;
+        }
+    }
+}
+
+static int scsi_write_protected(const scsi_state_t *state)
+{
+    return (state->lun->bdev->write == 0) || (state->lun->flags & SCSI_LUN_FLAG_WRITE_PROTECT);
+}
+
+/**
+ * Sets up WRITE SAME(10) / WRITE SAME(16). Returns what scsi_handle should return.
+ */
+static int32_t scsi_start_write_same(scsi_state_t *state, uint8_t *in_buf, int is_16)
+{
+    const uint8_t flags = state->cbw.cbwcb[1];
+    const int bad_range = is_16 ? scsi_setup_transfer_16(state) : scsi_setup_transfer_10(state);
+
+    if (scsi_write_protected(state)) {
+        return scsi_fail(state, in_buf, SCSI_SENSE_KEY_DATA_PROTECT, SCSI_ASC_WRITE_PROTECTED, 0);
+    } else if (bad_range) {
+        return scsi_fail(state, in_buf, SCSI_SENSE_KEY_ILLEGAL_REQUEST,
+                         SCSI_ASC_LBA_OUT_OF_RANGE, 0);
+    } else if ((state->blocks_remaining == 0) ||
+               ((state->blocks_remaining >> state->lun->block_shift) >
+                scsi_isr_block_limit(state->lun))) {
+        // WSNZ is set in the Block Limits page; "the whole rest of the disk" isn't supported,
+        // and neither is anything over the maximum WRITE SAME length it gives.
+        return scsi_fail(state, in_buf, SCSI_SENSE_KEY_ILLEGAL_REQUEST,
+                         SCSI_ASC_INVALID_FIELD_IN_CDB, 0);
+    }
+
+    // a short (or, with NDOB, missing) data block is padded out with zeros.
+    memset(state->block_buf, 0, BLOCK_DEVICE_BLOCK_SIZE);
+    state->block_offset = 0;
+
+    if (is_16 && (flags & SCSI_WRITE_SAME_NDOB)) {
+        scsi_write_same(state);
+    } else if (state->data_stage_bytes_remaining > 0) {
+        state->current_state = CBW_FLOW_EXPECTING_DATA_OUT_STATE;
+        return -1;
+    } else {
+        scsi_write_same(state);
+    }
+
+    state->current_state = CBW_FLOW_CSW_PENDING_STATE;
+    return scsi_fill_csw(state, in_buf);
+}
+
+/**
+ * START STOP UNIT. The media have nothing to write back or power down (see block_device.h), so
+ * this only moves the LUN between running, stopped and ejected; once they're all stopped the main
+ * loop sleeps. Ejection is refused while the host has the medium locked.
+ */
+static int32_t scsi_start_stop_unit(scsi_state_t *state, uint8_t *in_buf)
+{
+    scsi_lun_t *lun = state->lun;
+    const uint8_t flags = state->cbw.cbwcb[4];
+
+    // Power conditions other than START_VALID don't map onto anything here; take them as a no-op.
+    if (flags & SCSI_START_STOP_POWER_CONDITION_MASK) {
+        state->current_state = CBW_FLOW_CSW_PENDING_STATE;
+        return scsi_fill_csw(state, in_buf);
+    }
+
+    if (flags & SCSI_START_STOP_START) {
+        if (lun->power_state == SCSI_LUN_EJECTED) {
+            // it's "a new medium" as far as the host is concerned
+            lun->unit_attention = 1;
+        }
+        lun->power_state = SCSI_LUN_RUNNING;
+    } else {
+        const int eject = flags & SCSI_START_STOP_LOEJ;
+        if (eject && lun->removal_prevented) {
+            return scsi_fail(state, in_buf, SCSI_SENSE_KEY_ILLEGAL_REQUEST,
+                             SCSI_ASC_MEDIUM_REMOVAL_PREVENTED,
+                             SCSI_ASCQ_MEDIUM_REMOVAL_PREVENTED);
+        }
+        lun->power_state = eject ? SCSI_LUN_EJECTED : SCSI_LUN_STOPPED;
+    }
+
+    state->current_state = CBW_FLOW_CSW_PENDING_STATE;
+    return scsi_fill_csw(state, in_buf);
+}
+
+/**
+ * Brings a stopped LUN back up for a command that touches the medium. Returns nonzero (with the
+ * sense data set) if the medium isn't there to be touched: it's been ejected, or it's empty
+ * because its backend failed to come up (a bad ROM disk image, say).
+ */
+static int scsi_wake_lun(scsi_state_t *state)
+{
+    scsi_lun_t *lun = state->lun;
+    const block_device_t *bdev = lun->bdev;
+
+    if ((lun->power_state == SCSI_LUN_EJECTED) || (bdev->read == 0) ||
+        (scsi_logical_block_count(lun) == 0)) {
+        scsi_set_sense(state, SCSI_SENSE_KEY_NOT_READY, SCSI_ASC_MEDIUM_NOT_PRESENT, 0);
+        return 1;
+    } else if (lun->power_state == SCSI_LUN_STOPPED) {
+        lun->power_state = SCSI_LUN_RUNNING;
+    }
+    return 0;
+}
+
+void scsi_medium_changed(scsi_state_t *state, uint8_t lun)
+{
+    if (lun < state->lun_count) {
+        state->luns[lun].unit_attention = 1;
+    }
+}
+
+void scsi_init(scsi_state_t *state)
+{
+    memset(state, 0, sizeof(*state));
+    state->lun = &state->unsupported_lun;
+    state->current_state = CBW_FLOW_EXPECTING_CBW_STATE;
+    latency_reset();
+}
+
+void scsi_reset(scsi_state_t *state)
+{
+    state->current_state = CBW_FLOW_EXPECTING_CBW_STATE;
+    state->data_stage_bytes_remaining = 0;
+}
+
+int scsi_add_lun(scsi_state_t *state, const block_device_t *bdev, uint8_t logical_block_shift,
+                 uint8_t flags)
+{
+    if (state->lun_count == SCSI_MAX_LUNS) {
+        return -1;
+    }
+
+    scsi_lun_t *lun = &state->luns[state->lun_count];
+    lun->bdev = bdev;
+    lun->block_shift = logical_block_shift - BLOCK_DEVICE_BLOCK_SHIFT;
+    lun->flags = flags;
+    return state->lun_count++;
+}
+
+int scsi_medium_removal_prevented(const scsi_state_t *state, uint8_t lun)
+{
+    return (lun < state->lun_count) && state->luns[lun].removal_prevented;
+}
+
+int scsi_idle(const scsi_state_t *state)
+{
+    for (uint8_t i = 0; i < state->lun_count; i++) {
+        if (state->luns[i].power_state == SCSI_LUN_RUNNING) {
+            return 0;
+        }
+    }
+    return state->lun_count != 0;
+}
+
+uint8_t scsi_max_lun(const scsi_state_t *state)
+{
+    return state->lun_count ? (state->lun_count - 1) : 0;
+}
 
 /**
  * probably will be called from an interrupt context
@@ -36,66 +675,336 @@ int32_t scsi_handle(scsi_state_t *state,
     int32_t bytes_to_send = 0;
     switch (state->current_state) {
         case CBW_FLOW_EXPECTING_CBW_STATE: {
-            if (dir != USB_TRANSFER_DIRECTION_OUT) {
+            uint32_t signature = 0;
+            if (out_buf_nbytes >= sizeof(signature)) {
+                memcpy(&signature, out_buf, sizeof(signature));
+            }
+
+            if (dir == USB_TRANSFER_DIRECTION_IN) {
+                // The host clearing the IN endpoint's halt after a CBW was refused: nothing's
+                // owed, so nothing is sent.
+                bytes_to_send = -1;
+            } else if (dir != USB_TRANSFER_DIRECTION_OUT) {
                 state->current_state = CBW_FLOW_ERROR_STATE;
+            } else if ((out_buf_nbytes != sizeof(state->cbw)) ||
+                       (signature != USB_MASS_STORAGE_CBW_SIGNATURE)) {
+                // Bulk-only transport says a CBW is exactly 31 bytes starting with "USBC", and
+                // anything else is invalid. Copying it would run past cbw into the rest of the
+                // state, so it's refused with a STALL and the next packet is taken as a fresh CBW.
+                bytes_to_send = -2;
             } else {
-                memcpy((void*)&state->cbw, out_buf, out_buf_nbytes);
+                memcpy((void*)&state->cbw, out_buf, sizeof(state->cbw));
+                MTB_COMMAND_BEGIN();
+                latency_cbw(state->cbw.cbwcb[0]);
+                stats_command(state->cbw.cbwcb[0]);
                 state->data_stage_bytes_remaining = state->cbw.cbw_data_transfer_length;
                 state->csw.csw_status = 0;
+
+                // A CBW for a LUN that doesn't exist only gets INQUIRY (which says there's nothing
+                // there) and REQUEST SENSE (which says why) answered.
+                if (state->cbw.cbw_lun < state->lun_count) {
+                    state->lun = &state->luns[state->cbw.cbw_lun];
+                } else {
+                    state->lun = &state->unsupported_lun;
+                    scsi_set_sense(state, SCSI_SENSE_KEY_ILLEGAL_REQUEST,
+                                   SCSI_ASC_LOGICAL_UNIT_NOT_SUPPORTED, 0);
+                    if ((state->cbw.cbwcb[0] == SCSI_COMMAND_INQUIRY) &&
+                        !(state->cbw.cbwcb[1] & SCSI_INQUIRY_EVPD)) {
+                        uint8_t inquiry[sizeof(scsi_inquiry_response)];
+                        memcpy(inquiry, scsi_inquiry_response, sizeof(inquiry));
+                        inquiry[0] = 0x7f;  // peripheral qualifier 3: no LUN here
+                        bytes_to_send = scsi_send_response(state, inquiry, sizeof(inquiry), in_buf);
+                        break;
+                    } else if (state->cbw.cbwcb[0] != SCSI_COMMAND_REQUEST_SENSE) {
+                        bytes_to_send = scsi_fail(state, in_buf, SCSI_SENSE_KEY_ILLEGAL_REQUEST,
+                                                  SCSI_ASC_LOGICAL_UNIT_NOT_SUPPORTED, 0);
+                        break;
+                    }
+                }
+
+                // After the medium changes under the host, the next command (other than the ones
+                // the host uses to find out what happened) has to fail with UNIT ATTENTION.
+                if (state->lun->unit_attention &&
+                    (state->cbw.cbwcb[0] != SCSI_COMMAND_INQUIRY) &&
+                    (state->cbw.cbwcb[0] != SCSI_COMMAND_REQUEST_SENSE)) {
+                    state->lun->unit_attention = 0;
+                    bytes_to_send = scsi_fail(state, in_buf, SCSI_SENSE_KEY_UNIT_ATTENTION,
+                                              SCSI_ASC_MEDIUM_MAY_HAVE_CHANGED, 0);
+                    break;
+                }
+
+                // Anything but the commands that don't need the medium wakes a stopped LUN (or
+                // fails NOT READY if it's been ejected).
+                switch (state->cbw.cbwcb[0]) {
+                    case SCSI_COMMAND_INQUIRY:
+                    case SCSI_COMMAND_REQUEST_SENSE:
+                    case SCSI_COMMAND_START_STOP_UNIT:
+                    case SCSI_COMMAND_PREVENT_ALLOW_MEDIUM_REMOVAL: {
+                        break;
+                    }
+
+                    default: {
+                        if (scsi_wake_lun(state)) {
+                            bytes_to_send = scsi_fail(state, in_buf, state->lun->sense_key,
+                                                      state->lun->sense_asc, 0);
+                        }
+                        break;
+                    }
+                }
+                if (state->csw.csw_status != 0) {
+                    break;
+                }
+
                 switch (state->cbw.cbwcb[0]) {
                     case SCSI_COMMAND_INQUIRY: {
-                        if (state->cbw.cbw_data_transfer_length > sizeof(scsi_inquiry_response)) {
-                            bytes_to_send = sizeof(scsi_inquiry_response);
+                        if (state->cbw.cbwcb[1] & SCSI_INQUIRY_EVPD) {
+                            uint8_t page[USB_BULK_PACKET_SIZE];
+                            const int32_t len = scsi_inquiry_vpd(state, state->cbw.cbwcb[2], page);
+                            if (len < 0) {
+                                bytes_to_send = scsi_fail(state, in_buf,
+                                                          SCSI_SENSE_KEY_ILLEGAL_REQUEST,
+                                                          SCSI_ASC_INVALID_FIELD_IN_CDB, 0);
+                            } else {
+                                bytes_to_send = scsi_send_response(state, page, len, in_buf);
+                            }
                         } else {
-                            bytes_to_send = state->cbw.cbw_data_transfer_length;
+                            bytes_to_send = scsi_send_response(state,
+                                                               scsi_inquiry_response,
+                                                               sizeof(scsi_inquiry_response),
+                                                               in_buf);
                         }
+                        break;
+                    }
 
-                        // fill the IN buffer
-                        memcpy(in_buf, scsi_inquiry_response, bytes_to_send);
+                    case SCSI_COMMAND_START_STOP_UNIT: {
+                        bytes_to_send = scsi_start_stop_unit(state, in_buf);
+                        break;
+                    }
 
-                        // update state
-                        state->data_stage_bytes_remaining -= bytes_to_send;
-                        state->current_state = CBW_FLOW_DATA_IN_PENDING_STATE;
+                    case SCSI_COMMAND_PREVENT_ALLOW_MEDIUM_REMOVAL: {
+                        state->lun->removal_prevented =
+                            state->cbw.cbwcb[4] & SCSI_PREVENT_ALLOW_PREVENT;
+                        bytes_to_send = scsi_fill_csw(state, in_buf);
+                        state->current_state = CBW_FLOW_CSW_PENDING_STATE;
                         break;
                     }
 
                     case SCSI_COMMAND_TEST_UNIT_READY: {
                         // construct a csw and send it
-                        // NB: lots of opportunity for clearing duplicated code here.
-                        memcpy(state->csw.csw_signature, "USBS", 4);
-                        state->csw.csw_tag = state->cbw.cbw_tag;
-                        state->csw.csw_data_residue = state->data_stage_bytes_remaining;
-                        state->csw.csw_status = 0;
-                        bytes_to_send = 13;
-                        memcpy(in_buf, &(state->csw), bytes_to_send);
+                        bytes_to_send = scsi_fill_csw(state, in_buf);
                         state->current_state = CBW_FLOW_CSW_PENDING_STATE;
                         break;
                     }
 
+                    case SCSI_COMMAND_REQUEST_SENSE: {
+                        uint8_t sense[18] = { 0 };
+                        sense[0] = 0x70;    // current error, fixed format
+                        if (state->lun->sense_info_valid) {
+                            sense[0] |= 0x80;
+                            scsi_put_be32(&sense[3], state->lun->sense_info);
+                        }
+                        sense[2] = state->lun->sense_key;
+                        sense[7] = 10;      // additional sense length
+                        sense[12] = state->lun->sense_asc;
+                        sense[13] = state->lun->sense_ascq;
+                        scsi_set_sense(state, SCSI_SENSE_KEY_NO_SENSE,
+                                       SCSI_ASC_NO_ADDITIONAL_SENSE, 0);
+
+                        bytes_to_send = scsi_send_response(state, sense, sizeof(sense), in_buf);
+                        break;
+                    }
+
 //                    case SCSI_COMMAND_MODE_SENSE_6: {
 //                        break;
 //                    }
 
                     case SCSI_COMMAND_READ_CAPACITY_10: {
-                        bytes_to_send = 8;
-                        memcpy(in_buf, scsi_capacity, bytes_to_send);
+                        uint8_t capacity[8];
+                        scsi_put_be32(&capacity[0], scsi_logical_block_count(state->lun) - 1);
+                        scsi_put_be32(&capacity[4], scsi_logical_block_size(state->lun));
+
+                        bytes_to_send = scsi_send_response(state, capacity, sizeof(capacity),
+                                                           in_buf);
+                        break;
+                    }
+
+                    case SCSI_COMMAND_SERVICE_ACTION_IN_16: {
+                        const uint8_t action = state->cbw.cbwcb[1] & SCSI_SERVICE_ACTION_MASK;
+                        if (action != SCSI_SERVICE_ACTION_READ_CAPACITY_16) {
+                            bytes_to_send = scsi_fail(state, in_buf,
+                                                      SCSI_SENSE_KEY_ILLEGAL_REQUEST,
+                                                      SCSI_ASC_INVALID_FIELD_IN_CDB, 0);
+                            break;
+                        }
+
+                        // READ CAPACITY(16): 64 bit last LBA, block length, no protection
+                        // information, and whether the medium is thin provisioned.
+                        uint8_t capacity[32] = { 0 };
+                        scsi_put_be32(&capacity[4], scsi_logical_block_count(state->lun) - 1);
+                        scsi_put_be32(&capacity[8], scsi_logical_block_size(state->lun));
+                        capacity[12] = 0x00;    // P_TYPE = 0, PROT_EN = 0
+                        if (state->lun->bdev->unmap) {
+                            capacity[14] = 0x80 |   // LBPME: UNMAP / WRITE SAME unmapping work
+                                           0x40;    // LBPRZ: unmapped blocks read back as zeros
+                        }
+
+                        bytes_to_send = scsi_send_response(state, capacity, sizeof(capacity),
+                                                           in_buf);
+                        break;
+                    }
+
+                    case SCSI_COMMAND_READ_10:
+                    case SCSI_COMMAND_READ_16: {
+                        const int bad_range = (state->cbw.cbwcb[0] == SCSI_COMMAND_READ_16) ?
+                                              scsi_setup_transfer_16(state) :
+                                              scsi_setup_transfer_10(state);
+                        if (bad_range) {
+                            bytes_to_send = scsi_fail(state, in_buf,
+                                                      SCSI_SENSE_KEY_ILLEGAL_REQUEST,
+                                                      SCSI_ASC_LBA_OUT_OF_RANGE, 0);
+                        } else if (state->blocks_remaining == 0) {
+                            bytes_to_send = scsi_fill_csw(state, in_buf);
+                            state->current_state = CBW_FLOW_CSW_PENDING_STATE;
+                        } else {
+                            state->block_offset = BLOCK_DEVICE_BLOCK_SIZE;
+                            bytes_to_send = scsi_read_packet(state, in_buf);
+                        }
+                        break;
+                    }
+
+                    case SCSI_COMMAND_WRITE_10:
+                    case SCSI_COMMAND_WRITE_16: {
+                        const int bad_range = (state->cbw.cbwcb[0] == SCSI_COMMAND_WRITE_16) ?
+                                              scsi_setup_transfer_16(state) :
+                                              scsi_setup_transfer_10(state);
+                        if (scsi_write_protected(state)) {
+                            bytes_to_send = scsi_fail(state, in_buf, SCSI_SENSE_KEY_DATA_PROTECT,
+                                                      SCSI_ASC_WRITE_PROTECTED, 0);
+                        } else if (bad_range) {
+                            bytes_to_send = scsi_fail(state, in_buf,
+                                                      SCSI_SENSE_KEY_ILLEGAL_REQUEST,
+                                                      SCSI_ASC_LBA_OUT_OF_RANGE, 0);
+                        } else if (state->data_stage_bytes_remaining > 0) {
+                            state->block_offset = 0;
+                            bytes_to_send = -1;
+                            state->current_state = CBW_FLOW_EXPECTING_DATA_OUT_STATE;
+                        } else {
+                            bytes_to_send = scsi_fill_csw(state, in_buf);
+                            state->current_state = CBW_FLOW_CSW_PENDING_STATE;
+                        }
+                        break;
+                    }
 
-                        // update state
-                        state->data_stage_bytes_remaining -= bytes_to_send;
-                        state->current_state = CBW_FLOW_DATA_IN_PENDING_STATE;
+                    case SCSI_COMMAND_VERIFY_10: {
+                        if (state->cbw.cbwcb[1] & SCSI_VERIFY_BYTCHK_MASK) {
+                            // comparing against host data isn't supported
+                            bytes_to_send = scsi_fail(state, in_buf,
+                                                      SCSI_SENSE_KEY_ILLEGAL_REQUEST,
+                                                      SCSI_ASC_INVALID_FIELD_IN_CDB, 0);
+                        } else if (scsi_setup_transfer_10(state)) {
+                            bytes_to_send = scsi_fail(state, in_buf,
+                                                      SCSI_SENSE_KEY_ILLEGAL_REQUEST,
+                                                      SCSI_ASC_LBA_OUT_OF_RANGE, 0);
+                        } else if (scsi_get_be16(&state->cbw.cbwcb[7]) >
+                                   scsi_isr_block_limit(state->lun)) {
+                            bytes_to_send = scsi_fail(state, in_buf,
+                                                      SCSI_SENSE_KEY_ILLEGAL_REQUEST,
+                                                      SCSI_ASC_INVALID_FIELD_IN_CDB, 0);
+                        } else {
+                            scsi_verify(state);
+                            bytes_to_send = scsi_fill_csw(state, in_buf);
+                            state->current_state = CBW_FLOW_CSW_PENDING_STATE;
+                        }
+                        break;
+                    }
+
+                    case SCSI_COMMAND_WRITE_SAME_10: {
+                        bytes_to_send = scsi_start_write_same(state, in_buf, 0);
+                        break;
+                    }
+
+                    case SCSI_COMMAND_WRITE_SAME_16: {
+                        bytes_to_send = scsi_start_write_same(state, in_buf, 1);
+                        break;
+                    }
+
+                    case SCSI_COMMAND_UNMAP: {
+                        state->block_offset = 0;
+                        if (state->lun->bdev->unmap == 0) {
+                            bytes_to_send = scsi_fail(state, in_buf,
+                                                      SCSI_SENSE_KEY_ILLEGAL_REQUEST,
+                                                      SCSI_ASC_INVALID_COMMAND_OPERATION_CODE, 0);
+                        } else if (scsi_write_protected(state)) {
+                            bytes_to_send = scsi_fail(state, in_buf, SCSI_SENSE_KEY_DATA_PROTECT,
+                                                      SCSI_ASC_WRITE_PROTECTED, 0);
+                        } else if (scsi_get_be16(&state->cbw.cbwcb[7]) > BLOCK_DEVICE_BLOCK_SIZE) {
+                            bytes_to_send = scsi_fail(state, in_buf,
+                                                      SCSI_SENSE_KEY_ILLEGAL_REQUEST,
+                                                      SCSI_ASC_INVALID_FIELD_IN_CDB, 0);
+                        } else if (state->data_stage_bytes_remaining > 0) {
+                            bytes_to_send = -1;
+                            state->current_state = CBW_FLOW_EXPECTING_DATA_OUT_STATE;
+                        } else {
+                            bytes_to_send = scsi_fill_csw(state, in_buf);
+                            state->current_state = CBW_FLOW_CSW_PENDING_STATE;
+                        }
                         break;
                     }
 
+                    case SCSI_COMMAND_VENDOR_REVERT_MEDIUM: {
+                        // Like SW0, this can't swap the medium out while the host has it locked.
+                        const block_device_t *bdev = state->lun->bdev;
+                        if (state->lun->removal_prevented) {
+                            bytes_to_send = scsi_fail(state, in_buf, SCSI_SENSE_KEY_NOT_READY,
+                                                      SCSI_ASC_MEDIUM_REMOVAL_PREVENTED,
+                                                      SCSI_ASCQ_MEDIUM_REMOVAL_PREVENTED);
+                        } else if ((bdev->revert == 0) || bdev->revert(bdev)) {
+                            bytes_to_send = scsi_fail(state, in_buf,
+                                                      SCSI_SENSE_KEY_ILLEGAL_REQUEST,
+                                                      SCSI_ASC_INVALID_COMMAND_OPERATION_CODE, 0);
+                        } else {
+                            state->lun->unit_attention = 1;
+                            bytes_to_send = scsi_fill_csw(state, in_buf);
+                            state->current_state = CBW_FLOW_CSW_PENDING_STATE;
+                        }
+                        break;
+                    }
+
+                    case SCSI_COMMAND_VENDOR_STATS: {
+                        stats_report(&state->block_buf[BLOCK_DEVICE_BLOCK_SIZE -
+                                                       STATS_REPORT_SIZE]);
+                        bytes_to_send = scsi_send_block_buf_tail(state, STATS_REPORT_SIZE, in_buf);
+                        break;
+                    }
+
+#if defined(LATENCY_STATS)
+                    case SCSI_COMMAND_VENDOR_LATENCY: {
+                        uint8_t *report = &state->block_buf[BLOCK_DEVICE_BLOCK_SIZE -
+                                                            LATENCY_REPORT_SIZE];
+                        if (state->cbw.cbwcb[1] & SCSI_VENDOR_LATENCY_RESET) {
+                            latency_reset();
+                            bytes_to_send = scsi_fill_csw(state, in_buf);
+                            state->current_state = CBW_FLOW_CSW_PENDING_STATE;
+                        } else if (latency_report(state->cbw.cbwcb[2], report)) {
+                            bytes_to_send = scsi_fail(state, in_buf,
+                                                      SCSI_SENSE_KEY_ILLEGAL_REQUEST,
+                                                      SCSI_ASC_INVALID_FIELD_IN_CDB, 0);
+                        } else {
+                            bytes_to_send = scsi_send_block_buf_tail(state, LATENCY_REPORT_SIZE,
+                                                                     in_buf);
+                        }
+                        break;
+                    }
+#endif
+
                         // SPC-3: top of page 23
                         // If a device server receives a CDB containing an operation
                         // code that is invalid or not supported, the command shall be terminated
                         // with CHECK CONDITION status, with the sense key set to ILLEGAL REQUEST,
                         // and the additional sense code set to INVALID COMMAND OPERATION CODE.
                     default: {
-                        // TODO: handle unsupported command: stall BULK-in pipe
-                        state->current_state = CBW_FLOW_DATA_IN_PENDING_STATE;
-                        bytes_to_send = -2;
-                        state->csw.csw_status = 1;
+                        bytes_to_send = scsi_fail(state, in_buf, SCSI_SENSE_KEY_ILLEGAL_REQUEST,
+                                                  SCSI_ASC_INVALID_COMMAND_OPERATION_CODE, 0);
                         break;
                     }
                 }
@@ -110,38 +1019,62 @@ int32_t scsi_handle(scsi_state_t *state,
                 state->current_state = CBW_FLOW_ERROR_STATE;
             } else {
                 if (dir == USB_TRANSFER_DIRECTION_OUT) {
+                    latency_data();
                     switch (state->cbw.cbwcb[0]) {
+                        case SCSI_COMMAND_WRITE_10:
+                        case SCSI_COMMAND_WRITE_16: {
+                            scsi_write_packet(state, out_buf, out_buf_nbytes);
+                            break;
+                        }
+
+                        case SCSI_COMMAND_WRITE_SAME_10:
+                        case SCSI_COMMAND_WRITE_SAME_16: {
+                            scsi_collect_pattern(state, out_buf, out_buf_nbytes);
+                            if ((state->data_stage_bytes_remaining <= 0) &&
+                                (state->csw.csw_status == 0)) {
+                                scsi_write_same(state);
+                            }
+                            break;
+                        }
+
+                        case SCSI_COMMAND_UNMAP: {
+                            scsi_collect_parameters(state, out_buf, out_buf_nbytes);
+                            if ((state->data_stage_bytes_remaining <= 0) &&
+                                (state->csw.csw_status == 0)) {
+                                scsi_unmap(state);
+                            }
+                            break;
+                        }
+
                         default: {
-                            // this should never happen
-                            state->current_state = CBW_FLOW_DATA_IN_PENDING_STATE;
-                            state->csw.csw_status = 1;
+                            // the command already failed; throw its data away.
+                            state->data_stage_bytes_remaining -= out_buf_nbytes;
                             break;
                         }
                     }
+
+                    // keep going until the host has sent everything it said it would.
+                    if (state->data_stage_bytes_remaining > 0) {
+                        bytes_to_send = -1;
+                        break;
+                    }
                 }
 
-                // TODO: how to handle spaghetti logic if result of switch statement "doesn't want"
-                // a CSW sent?
                 // Send a CSW based on what happened during the "do it" part.
-                memcpy(state->csw.csw_signature, "USBS", 4);
-                state->csw.csw_tag = state->cbw.cbw_tag;
-                state->csw.csw_data_residue = state->data_stage_bytes_remaining;
-                bytes_to_send = 13;
-                memcpy(in_buf, &(state->csw), bytes_to_send);
-
+                bytes_to_send = scsi_fill_csw(state, in_buf);
                 state->current_state = CBW_FLOW_CSW_PENDING_STATE;
             }
             break;
         }
 
+        case CBW_FLOW_DATA_IN_STATE: {
+            bytes_to_send = scsi_read_packet(state, in_buf);
+            break;
+        }
+
         case CBW_FLOW_DATA_IN_PENDING_STATE: {
             // just send the CSW
-            memcpy(state->csw.csw_signature, "USBS", 4);
-            state->csw.csw_tag = state->cbw.cbw_tag;
-            state->csw.csw_data_residue = state->data_stage_bytes_remaining;
-            bytes_to_send = 13;
-            memcpy(in_buf, &(state->csw), bytes_to_send);
-
+            bytes_to_send = scsi_fill_csw(state, in_buf);
             state->current_state = CBW_FLOW_CSW_PENDING_STATE;
 
             break;
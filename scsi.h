@@ -3,6 +3,8 @@
 
 #include <stdint.h>
 
+#include "block_device.h"
+
 #pragma pack(push, 1)
 typedef struct usb_mass_storage_cbw
 {
@@ -17,6 +19,9 @@ typedef struct usb_mass_storage_cbw
 } usb_mass_storage_cbw_t;
 #pragma pack(pop)
 
+#define USB_MASS_STORAGE_CBW_SIGNATURE 0x43425355  // "USBC"
+#define USB_MASS_STORAGE_CBW_FLAG_IN 0x80
+
 
 #pragma pack(push, 1)
 typedef struct usb_mass_storage_csw
@@ -30,6 +35,7 @@ typedef struct usb_mass_storage_csw
 
 typedef enum cbw_flow {
     CBW_FLOW_EXPECTING_CBW_STATE,
+    CBW_FLOW_DATA_IN_STATE,
     CBW_FLOW_DATA_IN_PENDING_STATE,
     CBW_FLOW_EXPECTING_DATA_OUT_STATE,
     CBW_FLOW_CSW_PENDING_STATE,
@@ -43,6 +49,64 @@ typedef enum usb_transfer_direction {
     USB_TRANSFER_DIRECTION_IN_STALL
 } usb_transfer_direction_e;
 
+#ifndef SCSI_MAX_LUNS
+#define SCSI_MAX_LUNS 2
+#endif
+
+/**
+ * WRITE SAME and VERIFY have no data stage to spread their work over, so each runs its whole block
+ * loop inside the USB interrupt. To keep that from shutting out every other interrupt for long,
+ * they're refused past this many medium blocks (a couple of milliseconds of writes or ROM disk
+ * reads); the Block Limits VPD page tells the host the WRITE SAME limit. It has to cover one of the
+ * biggest logical blocks.
+ */
+#ifndef SCSI_ISR_BLOCKS_MAX
+#define SCSI_ISR_BLOCKS_MAX 32
+#endif
+#if SCSI_ISR_BLOCKS_MAX < 4
+#error "SCSI_ISR_BLOCKS_MAX must be at least 4"
+#endif
+
+#define SCSI_LUN_FLAG_WRITE_PROTECT 0x01
+
+// A stopped LUN starts up again on the next command that touches the medium. An ejected one stays
+// NOT READY until the host loads it again with START STOP UNIT.
+#define SCSI_LUN_RUNNING 0
+#define SCSI_LUN_STOPPED 1
+#define SCSI_LUN_EJECTED 2
+
+/**
+ * Everything that belongs to one logical unit. Commands only ever run one at a time, so the data
+ * stage bookkeeping and block buffer in scsi_state_t are shared between LUNs; a busy LUN can't
+ * hold them across commands.
+ */
+typedef struct scsi_lun {
+    const block_device_t *bdev;
+
+    // The host sees logical blocks of (BLOCK_DEVICE_BLOCK_SIZE << block_shift) bytes. CDB fields
+    // get converted to medium blocks on the way in; the data stage works in medium blocks.
+    uint8_t block_shift;
+
+    // SCSI_LUN_FLAG_*
+    uint8_t flags;
+
+    // fixed format sense data for the next REQUEST SENSE
+    uint8_t sense_key;
+    uint8_t sense_asc;
+    uint8_t sense_ascq;
+    uint8_t sense_info_valid;
+    uint32_t sense_info;
+
+    // set when the medium has changed under the host's feet
+    uint8_t unit_attention;
+
+    // SCSI_LUN_RUNNING / STOPPED / EJECTED, as set by START STOP UNIT
+    uint8_t power_state;
+
+    // set by PREVENT ALLOW MEDIUM REMOVAL; the medium can't be ejected or swapped out
+    uint8_t removal_prevented;
+} scsi_lun_t;
+
 typedef struct scsi_state {
     usb_mass_storage_cbw_t cbw;
     usb_mass_storage_csw_t csw;
@@ -50,11 +114,51 @@ typedef struct scsi_state {
 
     // TODO: this should either be unsigned or I should confirm that it will never be > 0x7fffffff.
     int32_t data_stage_bytes_remaining;
+
+    // LUNs that have been added, and the one that the current CBW is addressed to. CBWs for LUNs
+    // that don't exist are pointed at unsupported_lun, which only holds their sense data.
+    scsi_lun_t luns[SCSI_MAX_LUNS];
+    uint8_t lun_count;
+    scsi_lun_t unsupported_lun;
+    scsi_lun_t *lun;
+
+    // READ / WRITE data stage bookkeeping. block_buf holds the block that's currently being
+    // chopped up into (or assembled from) endpoint-sized packets.
+    uint32_t lba;
+    uint32_t blocks_remaining;
+    uint32_t block_offset;
+    uint8_t block_buf[BLOCK_DEVICE_BLOCK_SIZE] __attribute__((aligned(4)));
 } scsi_state_t;
 
 
+#define USB_BULK_PACKET_SIZE 64
+
+/**
+ * Logical block size reported to the host: 512, 1024, 2048 or 4096 bytes. Bigger blocks mean fewer
+ * commands for the same amount of data. It's a build-time constant so that all the LBA math comes
+ * down to shifts; the M0+ has no divider.
+ */
+#ifndef SCSI_LOGICAL_BLOCK_SIZE
+#define SCSI_LOGICAL_BLOCK_SIZE 512
+#endif
+
+#if (SCSI_LOGICAL_BLOCK_SIZE == 512)
+#define SCSI_LOGICAL_BLOCK_SHIFT 9
+#elif (SCSI_LOGICAL_BLOCK_SIZE == 1024)
+#define SCSI_LOGICAL_BLOCK_SHIFT 10
+#elif (SCSI_LOGICAL_BLOCK_SIZE == 2048)
+#define SCSI_LOGICAL_BLOCK_SHIFT 11
+#elif (SCSI_LOGICAL_BLOCK_SIZE == 4096)
+#define SCSI_LOGICAL_BLOCK_SHIFT 12
+#else
+#error "SCSI_LOGICAL_BLOCK_SIZE must be 512, 1024, 2048 or 4096"
+#endif
+
 #define SCSI_COMMAND_TEST_UNIT_READY 0x00
+#define SCSI_COMMAND_REQUEST_SENSE 0x03
 #define SCSI_COMMAND_INQUIRY 0x12
+#define SCSI_COMMAND_START_STOP_UNIT 0x1b
+#define SCSI_COMMAND_PREVENT_ALLOW_MEDIUM_REMOVAL 0x1e
 
 // according to Jan Axelson's book, this command is not a mandatory SCSI command, but if I STALL it,
 // my laptop seems to throw a fit by trying to disable my BBB IN endpoint. Indeed, according to
@@ -62,6 +166,116 @@ typedef struct scsi_state {
 #define SCSI_COMMAND_MODE_SENSE_6 0x1a
 
 #define SCSI_COMMAND_READ_CAPACITY_10 0x25
+#define SCSI_COMMAND_READ_10 0x28
+#define SCSI_COMMAND_WRITE_10 0x2a
+#define SCSI_COMMAND_VERIFY_10 0x2f
+#define SCSI_COMMAND_WRITE_SAME_10 0x41
+#define SCSI_COMMAND_UNMAP 0x42
+#define SCSI_COMMAND_READ_16 0x88
+#define SCSI_COMMAND_WRITE_16 0x8a
+#define SCSI_COMMAND_WRITE_SAME_16 0x93
+#define SCSI_COMMAND_SERVICE_ACTION_IN_16 0x9e
+
+#define SCSI_SERVICE_ACTION_MASK 0x1f
+#define SCSI_SERVICE_ACTION_READ_CAPACITY_16 0x10
+
+#define SCSI_WRITE_SAME_NDOB 0x01
+
+#define SCSI_INQUIRY_EVPD 0x01
+#define SCSI_START_STOP_START 0x01
+#define SCSI_START_STOP_LOEJ 0x02
+#define SCSI_START_STOP_POWER_CONDITION_MASK 0xf0
+#define SCSI_PREVENT_ALLOW_PREVENT 0x01
+#define SCSI_VERIFY_BYTCHK_MASK 0x06
+
+#define SCSI_VPD_SUPPORTED_PAGES 0x00
+#define SCSI_VPD_UNIT_SERIAL_NUMBER 0x80
+#define SCSI_VPD_DEVICE_IDENTIFICATION 0x83
+#define SCSI_VPD_BLOCK_LIMITS 0xb0
+#define SCSI_VPD_BLOCK_DEVICE_CHARACTERISTICS 0xb1
+#define SCSI_VPD_LOGICAL_BLOCK_PROVISIONING 0xb2
+
+// UNMAP's parameter list is collected in the block buffer, which bounds how many descriptors fit.
+#define SCSI_UNMAP_MAX_DESCRIPTORS ((BLOCK_DEVICE_BLOCK_SIZE - 8) / 16)
+
+// Vendor specific. Throws away everything written to the medium and returns it to its original
+// contents (e.g. drops the copy-on-write overlay on top of the ROM disk). No data stage.
+#define SCSI_COMMAND_VENDOR_REVERT_MEDIUM 0xc0
+
+// Vendor specific, only in firmware built with LATENCY_STATS. Returns the latency report for the
+// slot in byte 2 of the CDB (see latency.h), or, with SCSI_VENDOR_LATENCY_RESET set in byte 1,
+// clears all of them and has no data stage.
+#define SCSI_COMMAND_VENDOR_LATENCY 0xc1
+#define SCSI_VENDOR_LATENCY_RESET 0x01
+
+// Vendor specific. Returns the device's counters (see stats.h).
+#define SCSI_COMMAND_VENDOR_STATS 0xc2
+
+#define SCSI_SENSE_KEY_NO_SENSE 0x00
+#define SCSI_SENSE_KEY_NOT_READY 0x02
+#define SCSI_SENSE_KEY_MEDIUM_ERROR 0x03
+#define SCSI_SENSE_KEY_ILLEGAL_REQUEST 0x05
+#define SCSI_SENSE_KEY_UNIT_ATTENTION 0x06
+#define SCSI_SENSE_KEY_DATA_PROTECT 0x07
+
+#define SCSI_ASC_NO_ADDITIONAL_SENSE 0x00
+#define SCSI_ASC_WRITE_ERROR 0x0c
+#define SCSI_ASC_UNRECOVERED_READ_ERROR 0x11
+#define SCSI_ASC_INVALID_COMMAND_OPERATION_CODE 0x20
+#define SCSI_ASC_LBA_OUT_OF_RANGE 0x21
+#define SCSI_ASC_INVALID_FIELD_IN_CDB 0x24
+#define SCSI_ASC_LOGICAL_UNIT_NOT_SUPPORTED 0x25
+#define SCSI_ASC_INVALID_FIELD_IN_PARAMETER_LIST 0x26
+#define SCSI_ASC_WRITE_PROTECTED 0x27
+#define SCSI_ASC_MEDIUM_MAY_HAVE_CHANGED 0x28
+#define SCSI_ASC_MEDIUM_NOT_PRESENT 0x3a
+#define SCSI_ASC_MEDIUM_REMOVAL_PREVENTED 0x53
+#define SCSI_ASCQ_MEDIUM_REMOVAL_PREVENTED 0x02
+
+/**
+ * Resets the SCSI state so that it expects a CBW, with no LUNs.
+ */
+void scsi_init(scsi_state_t *state);
+
+/**
+ * Drops whatever command was in progress and goes back to expecting a CBW, keeping the LUNs and
+ * their sense data. For the mass storage class's Bulk-Only Mass Storage Reset request and USB bus
+ * resets.
+ */
+void scsi_reset(scsi_state_t *state);
+
+/**
+ * Adds a LUN backed by bdev and returns its number, or -1 if there are already SCSI_MAX_LUNS. The
+ * host sees the medium as logical blocks of 1 << logical_block_shift bytes (see
+ * SCSI_LOGICAL_BLOCK_SHIFT); any medium blocks left over at the end that don't make up a whole
+ * logical block are hidden. flags is a combination of SCSI_LUN_FLAG_*.
+ */
+int scsi_add_lun(scsi_state_t *state, const block_device_t *bdev, uint8_t logical_block_shift,
+                 uint8_t flags);
+
+/**
+ * The answer to the mass storage class's Get Max LUN request: the highest LUN number.
+ */
+uint8_t scsi_max_lun(const scsi_state_t *state);
+
+/**
+ * Tells the SCSI layer that a LUN's medium changed behind the host's back, so the host gets a UNIT
+ * ATTENTION and rereads whatever it had cached.
+ */
+void scsi_medium_changed(scsi_state_t *state, uint8_t lun);
+
+/**
+ * Returns nonzero if the host has locked a LUN's medium in place with PREVENT ALLOW MEDIUM REMOVAL,
+ * in which case nothing else should swap its contents out either.
+ */
+int scsi_medium_removal_prevented(const scsi_state_t *state, uint8_t lun);
+
+/**
+ * Returns nonzero if every LUN has been stopped or ejected, i.e. nothing needs the CPU until the
+ * host sends another command.
+ */
+int scsi_idle(const scsi_state_t *state);
+
 /**
  * Returns number of bytes processed, 0 indicates that a ZLP should be sent.
  * Returns -1 if there is no data to send
@@ -0,0 +1,19 @@
+#include "serial_number.h"
+
+#include <stdint.h>
+
+void serial_number_hex(char *buf)
+{
+    // the serial number's words aren't contiguous
+    static const volatile uint32_t *serial[] = {
+        (void*)0x0080a00c, (void*)0x0080a040, (void*)0x0080a044, (void*)0x0080a048
+    };
+
+    for (int i = 0; i < 4; i++) {
+        uint32_t x = *serial[i];
+        for (int j = 0; j < 8; j++, x <<= 4) {
+            const uint8_t nibble = x >> 28;
+            *buf++ = (nibble <= 9) ? ('0' + nibble) : ('a' + nibble - 10);
+        }
+    }
+}
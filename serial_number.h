@@ -0,0 +1,15 @@
+#ifndef SERIAL_NUMBER_H
+#define SERIAL_NUMBER_H
+
+/**
+ * The samd21's factory-programmed 128 bit serial number, as 32 lowercase hex digits. Used wherever
+ * the device has to identify itself (STATUS.TXT, the SCSI unit serial number VPD page).
+ */
+#define SERIAL_NUMBER_HEX_LEN 32
+
+/**
+ * Writes SERIAL_NUMBER_HEX_LEN characters to buf; no terminator.
+ */
+void serial_number_hex(char *buf);
+
+#endif
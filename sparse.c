@@ -0,0 +1,98 @@
+#include "sparse.h"
+
+#include "dmac.h"
+
+#include <string.h>
+
+typedef struct sparse
+{
+    const block_device_t *base;
+    uint32_t holes[(SPARSE_BLOCKS + 31) / 32];
+} sparse_t;
+
+static sparse_t sparse;
+
+static int sparse_is_hole(const sparse_t *sp, uint32_t lba)
+{
+    return (lba < SPARSE_BLOCKS) && (sp->holes[lba >> 5] & (1u << (lba & 31)));
+}
+
+static int sparse_read(const block_device_t *dev, uint32_t lba, uint8_t *buf)
+{
+    const sparse_t *sp = dev->ctx;
+
+    if (sparse_is_hole(sp, lba)) {
+        dmac_fill(buf, 0, BLOCK_DEVICE_BLOCK_SIZE);
+        return 0;
+    }
+    return sp->base->read(sp->base, lba, buf);
+}
+
+static int sparse_write(const block_device_t *dev, uint32_t lba, const uint8_t *buf)
+{
+    sparse_t *sp = dev->ctx;
+
+    if (lba >= SPARSE_BLOCKS) {
+        return sp->base->write(sp->base, lba, buf);
+    }
+
+    if (block_device_is_zero(buf)) {
+        // Let the base drop whatever it had there if it can, but it doesn't matter if it can't;
+        // the hole hides it either way.
+        if (sp->base->unmap) {
+            sp->base->unmap(sp->base, lba, 1);
+        }
+        sp->holes[lba >> 5] |= (1u << (lba & 31));
+        return 0;
+    }
+
+    if (sp->base->write(sp->base, lba, buf)) {
+        return 1;
+    }
+    sp->holes[lba >> 5] &= ~(1u << (lba & 31));
+    return 0;
+}
+
+static int sparse_unmap(const block_device_t *dev, uint32_t lba, uint32_t count)
+{
+    sparse_t *sp = dev->ctx;
+    const block_device_t *base = sp->base;
+
+    if (base->unmap && base->unmap(base, lba, count)) {
+        return 1;
+    }
+
+    for (; count && (lba < SPARSE_BLOCKS); count--, lba++) {
+        sp->holes[lba >> 5] |= (1u << (lba & 31));
+    }
+    return 0;
+}
+
+static int sparse_revert(const block_device_t *dev)
+{
+    sparse_t *sp = dev->ctx;
+
+    if (sp->base->revert(sp->base)) {
+        return 1;
+    }
+    memset(sp->holes, 0, sizeof(sp->holes));
+    return 0;
+}
+
+void sparse_init(block_device_t *dev, const block_device_t *base)
+{
+    sparse.base = base;
+    memset(sparse.holes, 0, sizeof(sparse.holes));
+
+    *dev = (block_device_t) {
+        .ctx = &sparse,
+        .block_count = base->block_count,
+        .optimal_blocks = base->optimal_blocks,
+        .read = sparse_read,
+        .write = base->write ? sparse_write : 0,
+        .revert = base->revert ? sparse_revert : 0,
+        // Without help from the base, only sectors the bitmap covers can be unmapped.
+        .unmap = (base->unmap || (base->write && (base->block_count <= SPARSE_BLOCKS))) ?
+                 sparse_unmap : 0,
+    };
+}
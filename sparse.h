@@ -0,0 +1,28 @@
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include "block_device.h"
+
+/**
+ * Zero sector elision on top of any medium. Writes of all-zero sectors never reach the base; the
+ * sector is just marked as a hole in a bitmap, and reads of holes are filled with zeros by DMA
+ * without touching the base either. A freshly formatted FAT volume is mostly zeros, so this saves
+ * the base (and its erase cycles) most of the work of a format.
+ *
+ * The layer also turns UNMAP into marking holes, so it gives thin provisioning to media that
+ * don't have it themselves.
+ *
+ * The bitmap covers the first SPARSE_BLOCKS sectors, at one bit each; sectors past that go
+ * straight through to the base.
+ */
+#ifndef SPARSE_BLOCKS
+#define SPARSE_BLOCKS 4096
+#endif
+
+/**
+ * Fills in dev so that it's a zero eliding layer on top of base. base has to stay around for as
+ * long as dev does. Nothing starts out as a hole; the base's contents are taken as they are.
+ */
+void sparse_init(block_device_t *dev, const block_device_t *base);
+
+#endif
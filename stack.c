@@ -0,0 +1,20 @@
+#include "stack.h"
+
+// from the linker script
+extern uint32_t _sstack;
+extern uint32_t _estack;
+
+uint32_t stack_size(void)
+{
+    return (uint32_t)&_estack - (uint32_t)&_sstack;
+}
+
+uint32_t stack_high_water(void)
+{
+    // The stack grows down from _estack, so the paint survives at the bottom.
+    const uint32_t *p = &_sstack;
+    while ((p < &_estack) && (*p == STACK_PAINT)) {
+        p++;
+    }
+    return (uint32_t)&_estack - (uint32_t)p;
+}
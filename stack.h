@@ -0,0 +1,24 @@
+#ifndef STACK_H
+#define STACK_H
+
+#include <stdint.h>
+
+/**
+ * Reset_Handler paints everything below its own frame with STACK_PAINT before main runs, so the
+ * deepest the stack has ever gone is wherever the paint stops. That's only a lower bound on what
+ * the firmware needs (a path that hasn't run yet can go deeper); tools/stackusage.py gives the
+ * worst case from the compiler's -fstack-usage output at build time.
+ */
+#define STACK_PAINT 0xc5c5c5c5
+
+/**
+ * The size the linker script reserved for the stack, in bytes.
+ */
+uint32_t stack_size(void);
+
+/**
+ * How many bytes of the stack have ever been used since reset.
+ */
+uint32_t stack_high_water(void);
+
+#endif
@@ -32,6 +32,7 @@
  */
 
 #include "samd21.h"
+#include "stack.h"
 
 /* Initialize segments */
 extern uint32_t _sfixed;
@@ -241,6 +242,11 @@ void Reset_Handler(void)
                 *pDest++ = 0;
         }
 
+        /* Paint the stack below this frame for stack_high_water() */
+        for (pDest = &_sstack; pDest < (uint32_t *) __get_MSP();) {
+                *pDest++ = STACK_PAINT;
+        }
+
         /* Set the vector table base address */
         pSrc = (uint32_t *) & _sfixed;
         SCB->VTOR = ((uint32_t) pSrc & SCB_VTOR_TBLOFF_Msk);
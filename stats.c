@@ -0,0 +1,61 @@
+#include "stats.h"
+
+#include "scsi.h"
+#include "stack.h"
+
+#include <string.h>
+
+stats_t stats;
+
+// Every opcode the SCSI layer knows gets its own slot; the rest share slot 0.
+static const uint8_t stats_opcode_slot[256] =
+{
+    [SCSI_COMMAND_TEST_UNIT_READY] = 1,
+    [SCSI_COMMAND_REQUEST_SENSE] = 2,
+    [SCSI_COMMAND_INQUIRY] = 3,
+    [SCSI_COMMAND_MODE_SENSE_6] = 4,
+    [SCSI_COMMAND_START_STOP_UNIT] = 5,
+    [SCSI_COMMAND_PREVENT_ALLOW_MEDIUM_REMOVAL] = 6,
+    [SCSI_COMMAND_READ_CAPACITY_10] = 7,
+    [SCSI_COMMAND_READ_10] = 8,
+    [SCSI_COMMAND_WRITE_10] = 9,
+    [SCSI_COMMAND_VERIFY_10] = 10,
+    [SCSI_COMMAND_WRITE_SAME_10] = 11,
+    [SCSI_COMMAND_UNMAP] = 12,
+    [SCSI_COMMAND_READ_16] = 13,
+    [SCSI_COMMAND_WRITE_16] = 14,
+    [SCSI_COMMAND_WRITE_SAME_16] = 15,
+    [SCSI_COMMAND_SERVICE_ACTION_IN_16] = 16,
+    [SCSI_COMMAND_VENDOR_REVERT_MEDIUM] = 17,
+    [SCSI_COMMAND_VENDOR_LATENCY] = 18,
+    [SCSI_COMMAND_VENDOR_STATS] = 19,
+};
+
+static uint32_t stats_commands[STATS_OPCODE_SLOTS];
+
+void stats_command(uint8_t opcode)
+{
+    stats_commands[stats_opcode_slot[opcode]]++;
+}
+
+void stats_report(uint8_t *buf)
+{
+    stats.version = STATS_VERSION;
+    stats.opcode_slots = STATS_OPCODE_SLOTS;
+    stats.length = STATS_REPORT_SIZE;
+    stats.opcodes_offset = sizeof(stats_t);
+    stats.stack_size = stack_size();
+    stats.stack_high_water = stack_high_water();
+    memcpy(buf, &stats, sizeof(stats));
+
+    uint8_t *opcodes = &buf[sizeof(stats_t)];
+    memset(opcodes, 0, STATS_COMMANDS_OFFSET - sizeof(stats_t));
+    opcodes[0] = 0xff;
+    for (uint32_t op = 0; op < 256; op++) {
+        if (stats_opcode_slot[op]) {
+            opcodes[stats_opcode_slot[op]] = op;
+        }
+    }
+
+    memcpy(&buf[STATS_COMMANDS_OFFSET], stats_commands, sizeof(stats_commands));
+}
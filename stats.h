@@ -0,0 +1,79 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+/**
+ * Counters that are always kept, for scraping from the host with the vendor stats command
+ * (tools/stats.py) in production firmware. They're bumped directly wherever the thing they count
+ * happens, all of it in interrupt context at one priority, so no locking.
+ *
+ * The report is laid out as below, little endian. Fields are only ever appended to the counters,
+ * with version going up each time, so host tools can read any report at least as new as the one
+ * they were written for by ignoring what's past the fields they know.
+ *
+ *      0  uint8_t   version (STATS_VERSION)
+ *      1  uint8_t   number of opcode slots, N
+ *      2  uint16_t  length of the whole report
+ *      4  uint16_t  offset of the opcode section
+ *      6  uint16_t  reserved
+ *      8  the counters in stats_t
+ *
+ *     opcode section:
+ *         uint8_t   opcode[N]   slot 0 counts every opcode not listed; its opcode byte is 0xff
+ *         (padding to a multiple of 4)
+ *         uint32_t  commands[N]
+ */
+#define STATS_VERSION 3
+
+typedef struct stats
+{
+    // report header, filled in by stats_report
+    uint8_t version;
+    uint8_t opcode_slots;
+    uint16_t length;
+    uint16_t opcodes_offset;
+    uint16_t reserved;
+
+    // medium data moved for the host's READs and WRITEs
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+
+    uint32_t usb_interrupts;
+    uint32_t dmac_interrupts;
+    uint32_t usb_resets;
+    uint32_t stalls;
+
+    // reads of the ROM disk's overlay that found the block in SRAM, and ones that went to ROM
+    uint32_t overlay_hits;
+    uint32_t overlay_misses;
+
+    uint32_t flash_erases;
+
+    // version 2: trace records turned away because the log ring was full
+    uint32_t trace_dropped;
+
+    // version 3: the stack's size and the most of it that's been used (see stack.h)
+    uint32_t stack_size;
+    uint32_t stack_high_water;
+} stats_t;
+
+extern stats_t stats;
+
+// slot 0 plus one per opcode the SCSI layer implements
+#define STATS_OPCODE_SLOTS 20
+
+#define STATS_COMMANDS_OFFSET ((sizeof(stats_t) + STATS_OPCODE_SLOTS + 3) & ~3)
+#define STATS_REPORT_SIZE (STATS_COMMANDS_OFFSET + (4 * STATS_OPCODE_SLOTS))
+
+/**
+ * Counts a command with opcode.
+ */
+void stats_command(uint8_t opcode);
+
+/**
+ * Writes the report, STATS_REPORT_SIZE bytes, to buf.
+ */
+void stats_report(uint8_t *buf);
+
+#endif
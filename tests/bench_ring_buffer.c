@@ -0,0 +1,81 @@
+#include "char_buffer.h"
+#include "ring_buffer.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Moves the same bytes through char_buffer a byte at a time, the way SERCOM3_puts used to, and
+ * through ring_buffer with write/read spans, in the message sizes the log path sees. Both sides
+ * run on one thread so only the queue's own cost is measured. The host's barrier is a full fence,
+ * which is most of the cost of one-byte messages here; on the M0+ it's a dmb of a few cycles.
+ */
+#define BENCH_BYTES (64u << 20)
+#define RING_SIZE 1024
+
+static uint8_t space[RING_SIZE];
+static uint8_t message[64];
+static uint8_t out[64];
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec * 1e-9);
+}
+
+static double bench_char_buffer(uint32_t len)
+{
+    char_buffer_t cb;
+    char_buffer_init(&cb, space, sizeof(space));
+
+    const double start = now();
+    for (uint32_t done = 0; done < BENCH_BYTES; done += len) {
+        for (uint32_t i = 0; i < len; i++) {
+            char_buffer_putc(&cb, message[i]);
+        }
+        for (uint32_t i = 0; i < len; i++) {
+            char_buffer_getc(&cb, &out[i]);
+        }
+    }
+    return now() - start;
+}
+
+static double bench_ring_buffer(uint32_t len)
+{
+    ring_buffer_t rb;
+    ring_buffer_init(&rb, space, sizeof(space));
+
+    const double start = now();
+    for (uint32_t done = 0; done < BENCH_BYTES; done += len) {
+        ring_buffer_write(&rb, message, len);
+        for (uint32_t got = 0; got < len;) {
+            const uint8_t *span;
+            uint32_t n = ring_buffer_read_span(&rb, &span);
+            if (n > (len - got)) {
+                n = len - got;
+            }
+            memcpy(&out[got], span, n);
+            ring_buffer_read_commit(&rb, n);
+            got += n;
+        }
+    }
+    return now() - start;
+}
+
+int main(void)
+{
+    static const uint32_t lens[] = { 1, 8, 30, 64 };
+
+    for (uint32_t i = 0; i < sizeof(message); i++) {
+        message[i] = i;
+    }
+    printf("message  char_buffer  ring_buffer  (ns/byte)\n");
+    for (uint32_t i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+        const double cb = bench_char_buffer(lens[i]);
+        const double rb = bench_ring_buffer(lens[i]);
+        printf("%7u  %11.2f  %11.2f\n", lens[i], cb * 1e9 / BENCH_BYTES, rb * 1e9 / BENCH_BYTES);
+    }
+    return 0;
+}
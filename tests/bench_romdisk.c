@@ -0,0 +1,58 @@
+#include "romdisk.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * Times romdisk_read over every block of the test volume (see test_romdisk). Full-speed bulk moves
+ * at most 19 64-byte packets per 1ms frame, so the decompressor has about 420us per block to keep
+ * up with it; the M0+ at 48MHz runs this loop something like 20-50 times slower than a desktop
+ * core, so the host's slowest block wants to stay below about 10us. Each block's time is its best
+ * over all the passes, so the host's scheduler doesn't show up as a slow block.
+ */
+#define BENCH_PASSES 20
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec * 1e-9);
+}
+
+int main(void)
+{
+    static uint8_t buf[BLOCK_DEVICE_BLOCK_SIZE] __attribute__((aligned(4)));
+    block_device_t dev;
+    romdisk_init(&dev);
+
+    double *best = malloc(dev.block_count * sizeof(double));
+    for (uint32_t lba = 0; lba < dev.block_count; lba++) {
+        best[lba] = 1;
+    }
+
+    const double start = now();
+    for (int pass = 0; pass < BENCH_PASSES; pass++) {
+        for (uint32_t lba = 0; lba < dev.block_count; lba++) {
+            const double t = now();
+            if (dev.read(&dev, lba, buf)) {
+                fprintf(stderr, "block %u is corrupt\n", lba);
+                return 1;
+            }
+            const double took = now() - t;
+            best[lba] = (took < best[lba]) ? took : best[lba];
+        }
+    }
+    const double total = now() - start;
+    const double blocks = (double)dev.block_count * BENCH_PASSES;
+    uint32_t slowest = 0;
+    for (uint32_t lba = 0; lba < dev.block_count; lba++) {
+        slowest = (best[lba] > best[slowest]) ? lba : slowest;
+    }
+
+    printf("%u blocks x %d: %.1f MB/s, %.2f us/block average, %.2f us slowest (block %u)\n",
+           dev.block_count, BENCH_PASSES, blocks * BLOCK_DEVICE_BLOCK_SIZE / total / 1e6,
+           total / blocks * 1e6, best[slowest] * 1e6, slowest);
+    free(best);
+    return 0;
+}
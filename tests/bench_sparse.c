@@ -0,0 +1,232 @@
+#include "sparse.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Two measurements of the zero eliding layer:
+ *
+ *   - block_device_is_zero against a plain byte loop, on a zero block (the whole block has to be
+ *     scanned) and on blocks whose first non-zero byte is at the start, the middle and the end.
+ *   - the write traces of a full format of a FAT16 volume and of copying files onto it, played
+ *     through the layer onto an in-memory base: how many writes reach the base and what the layer
+ *     costs per write. Every sector is read back through the layer afterwards and checked against
+ *     what was written, so this also exits nonzero if the layer gets anything wrong.
+ */
+#define VOLUME_BLOCKS SPARSE_BLOCKS
+#define CLUSTER_BLOCKS 4
+#define FAT_BLOCKS 16
+#define ROOT_BLOCKS 32
+#define DATA_START (1 + (2 * FAT_BLOCKS) + ROOT_BLOCKS)
+
+static uint8_t base_data[VOLUME_BLOCKS][BLOCK_DEVICE_BLOCK_SIZE];
+static uint8_t shadow[VOLUME_BLOCKS][BLOCK_DEVICE_BLOCK_SIZE];
+static uint32_t base_writes;
+
+static int base_read(const block_device_t *dev, uint32_t lba, uint8_t *buf)
+{
+    memcpy(buf, base_data[lba], BLOCK_DEVICE_BLOCK_SIZE);
+    return 0;
+}
+
+static int base_write(const block_device_t *dev, uint32_t lba, const uint8_t *buf)
+{
+    memcpy(base_data[lba], buf, BLOCK_DEVICE_BLOCK_SIZE);
+    base_writes++;
+    return 0;
+}
+
+static const block_device_t base = {
+    .block_count = VOLUME_BLOCKS,
+    .read = base_read,
+    .write = base_write,
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec * 1e-9);
+}
+
+static int bytewise_is_zero(const uint8_t *buf)
+{
+    for (int i = 0; i < BLOCK_DEVICE_BLOCK_SIZE; i++) {
+        if (buf[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void bench_is_zero(void)
+{
+    static uint8_t blocks[4][BLOCK_DEVICE_BLOCK_SIZE] __attribute__((aligned(4)));
+    static const char *const names[] = { "zero", "first", "middle", "last" };
+    const int passes = 1 << 20;
+
+    blocks[1][0] = 1;
+    blocks[2][BLOCK_DEVICE_BLOCK_SIZE / 2] = 1;
+    blocks[3][BLOCK_DEVICE_BLOCK_SIZE - 1] = 1;
+
+    printf("non-zero byte  word scan  byte loop  (ns/block)\n");
+    for (int b = 0; b < 4; b++) {
+        volatile int sink = 0;
+        // the volatile pointer keeps the compiler from hoisting the scan out of the loop
+        uint8_t *volatile block = blocks[b];
+
+        double t = now();
+        for (int i = 0; i < passes; i++) {
+            sink += block_device_is_zero(block);
+        }
+        const double words = (now() - t) * 1e9 / passes;
+
+        t = now();
+        for (int i = 0; i < passes; i++) {
+            sink += bytewise_is_zero(block);
+        }
+        const double bytes = (now() - t) * 1e9 / passes;
+        printf("%13s  %9.1f  %9.1f\n", names[b], words, bytes);
+    }
+}
+
+static uint32_t seed = 1;
+
+static uint32_t next_random(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+static uint32_t trace_writes;
+static double trace_time;
+
+static void trace_write(block_device_t *dev, uint32_t lba, const uint8_t *buf)
+{
+    const double t = now();
+    if (dev->write(dev, lba, buf)) {
+        fprintf(stderr, "write of block %u failed\n", lba);
+        exit(1);
+    }
+    trace_time += now() - t;
+    trace_writes++;
+    memcpy(shadow[lba], buf, BLOCK_DEVICE_BLOCK_SIZE);
+}
+
+/**
+ * A full format: boot sector, both FATs with their media descriptor entries, an empty root
+ * directory with a volume label, and zeros over the whole data area.
+ */
+static void format(block_device_t *dev)
+{
+    uint8_t buf[BLOCK_DEVICE_BLOCK_SIZE] __attribute__((aligned(4)));
+
+    for (uint32_t lba = 0; lba < VOLUME_BLOCKS; lba++) {
+        memset(buf, 0, sizeof(buf));
+        if (lba == 0) {
+            memcpy(&buf[3], "MSDOS5.0", 8);
+            buf[510] = 0x55;
+            buf[511] = 0xaa;
+        } else if ((lba == 1) || (lba == (1 + FAT_BLOCKS))) {
+            memcpy(buf, "\xf8\xff\xff\xff", 4);
+        } else if (lba == (1 + (2 * FAT_BLOCKS))) {
+            memcpy(buf, "SCRATCH    \x08", 12);
+        }
+        trace_write(dev, lba, buf);
+    }
+}
+
+/**
+ * Copies files of random sizes onto the volume a cluster at a time, updating the FAT and root
+ * directory after each one. The tail of a file's last cluster is zero padded, so whole zero
+ * sectors turn up there too.
+ */
+static void copy_files(block_device_t *dev)
+{
+    uint8_t buf[BLOCK_DEVICE_BLOCK_SIZE] __attribute__((aligned(4)));
+    uint32_t cluster = 2;
+    uint32_t file = 0;
+
+    for (;;) {
+        const uint32_t size = 1 + (next_random() % (64 * 1024));
+        const uint32_t clusters = (size + (CLUSTER_BLOCKS * 512) - 1) / (CLUSTER_BLOCKS * 512);
+        const uint32_t first = DATA_START + ((cluster - 2) * CLUSTER_BLOCKS);
+        if ((first + (clusters * CLUSTER_BLOCKS)) > VOLUME_BLOCKS) {
+            break;
+        }
+
+        for (uint32_t n = 0; n < (clusters * CLUSTER_BLOCKS); n++) {
+            const uint32_t offset = n * BLOCK_DEVICE_BLOCK_SIZE;
+            memset(buf, 0, sizeof(buf));
+            for (uint32_t i = 0; (i < BLOCK_DEVICE_BLOCK_SIZE) && ((offset + i) < size); i++) {
+                buf[i] = next_random() | 1;
+            }
+            trace_write(dev, first + n, buf);
+        }
+
+        // FAT16 entries are two bytes, so one FAT sector covers 256 clusters
+        for (uint32_t copy = 0; copy < 2; copy++) {
+            const uint32_t fat = 1 + (copy * FAT_BLOCKS) + (cluster / 256);
+            memcpy(buf, shadow[fat], sizeof(buf));
+            for (uint32_t c = cluster; c < (cluster + clusters); c++) {
+                const uint16_t next = (c == (cluster + clusters - 1)) ? 0xffff : (c + 1);
+                if ((c / 256) == (cluster / 256)) {
+                    memcpy(&buf[(c % 256) * 2], &next, 2);
+                }
+            }
+            trace_write(dev, fat, buf);
+        }
+
+        const uint32_t dir = 1 + (2 * FAT_BLOCKS) + ((file + 1) / 16);
+        memcpy(buf, shadow[dir], sizeof(buf));
+        snprintf((char *)&buf[((file + 1) % 16) * 32], 12, "FILE%04uBIN", file % 10000);
+        trace_write(dev, dir, buf);
+
+        cluster += clusters;
+        file++;
+    }
+}
+
+static void replay(const char *name, void (*trace)(block_device_t *), block_device_t *dev)
+{
+    const uint32_t before = base_writes;
+    trace_writes = 0;
+    trace_time = 0;
+    trace(dev);
+
+    const uint32_t reached = base_writes - before;
+    printf("%-7s %6u writes, %6u reached the base (%4.1f%% elided), %.1f ns/write\n", name,
+           trace_writes, reached, 100.0 * (trace_writes - reached) / trace_writes,
+           trace_time * 1e9 / trace_writes);
+}
+
+int main(void)
+{
+    uint8_t buf[BLOCK_DEVICE_BLOCK_SIZE] __attribute__((aligned(4)));
+    block_device_t dev;
+
+    bench_is_zero();
+
+    // the base starts out full of junk, as flash that's been used before would be
+    for (uint32_t lba = 0; lba < VOLUME_BLOCKS; lba++) {
+        memset(base_data[lba], 0xa5, BLOCK_DEVICE_BLOCK_SIZE);
+        memset(shadow[lba], 0xa5, BLOCK_DEVICE_BLOCK_SIZE);
+    }
+    sparse_init(&dev, &base);
+
+    printf("\n");
+    replay("format", format, &dev);
+    replay("copy", copy_files, &dev);
+
+    for (uint32_t lba = 0; lba < VOLUME_BLOCKS; lba++) {
+        if (dev.read(&dev, lba, buf) || memcmp(buf, shadow[lba], sizeof(buf))) {
+            fprintf(stderr, "block %u reads back wrong\n", lba);
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -1,11 +1,11 @@
-/**
- * John Mamish is the sole copyright owner of this file.
- *
- * Licensed under GPL3
- */
+#ifndef CHAR_BUFFER_H
+#define CHAR_BUFFER_H
 
 #include <stdint.h>
 
+/**
+ * The byte queue that ring_buffer replaced, kept here only as the baseline for bench_ring_buffer.
+ */
 typedef struct char_buffer
 {
     uint8_t *data;
@@ -21,3 +21,5 @@ int char_buffer_isempty(const volatile char_buffer_t *cb);
 int char_buffer_putc(volatile char_buffer_t *cb, uint8_t put);
 
 int char_buffer_getc(volatile char_buffer_t *cb, uint8_t *get);
+
+#endif
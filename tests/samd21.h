@@ -0,0 +1,26 @@
+#ifndef SAMD21_H
+#define SAMD21_H
+
+#include <stdint.h>
+
+/**
+ * Just enough of the device header for the firmware sources the host tests build. Nothing here
+ * does anything; code that really needs the hardware isn't built for the host.
+ */
+typedef struct
+{
+    uint32_t VTOR;
+} SCB_Type;
+
+extern SCB_Type host_scb;
+#define SCB (&host_scb)
+
+#define HMCRAMC0_ADDR 0x20000000
+#define HMCRAMC0_SIZE 0x8000
+
+static inline void __set_MSP(uint32_t sp)
+{
+    (void)sp;
+}
+
+#endif
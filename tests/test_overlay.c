@@ -0,0 +1,179 @@
+// The remap table's internals are what's being measured, so this builds overlay.c in directly.
+#include "../overlay.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * Overlay correctness (hits, misses, a full pool, revert, a corrupted pool block) and the cost of
+ * remap table lookups: with the pool filled by each of a few LBA patterns a host really writes, the
+ * number of table entries a lookup has to look at, for LBAs in the overlay and LBAs that aren't.
+ * Linear probing in a table at most half full should average about 1.5 probes for a hit and 2.5
+ * for a miss; the checks leave some room over that. Built once per pool size in the Makefile.
+ */
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1); \
+        } \
+    } while (0)
+
+#define BASE_BLOCKS 65536
+
+static uint8_t base_fill(uint32_t lba)
+{
+    return (uint8_t)(lba ^ 0x5a);
+}
+
+static int base_read(const block_device_t *dev, uint32_t lba, uint8_t *buf)
+{
+    memset(buf, base_fill(lba), BLOCK_DEVICE_BLOCK_SIZE);
+    return 0;
+}
+
+static const block_device_t base = { .block_count = BASE_BLOCKS, .read = base_read };
+static block_device_t dev;
+static uint8_t buf[BLOCK_DEVICE_BLOCK_SIZE] __attribute__((aligned(4)));
+
+static uint32_t probes(uint32_t lba)
+{
+    uint32_t i = overlay_hash(lba);
+    uint32_t n = 1;
+    while ((overlay.keys[i] != OVERLAY_EMPTY) && (overlay.keys[i] != lba)) {
+        i = (i + 1) & (OVERLAY_HASH_SIZE - 1);
+        n++;
+    }
+    return n;
+}
+
+static void test_correctness(void)
+{
+    uint8_t data[BLOCK_DEVICE_BLOCK_SIZE] __attribute__((aligned(4)));
+
+    dev.revert(&dev);
+    CHECK(dev.read(&dev, 100, buf) == 0);
+    CHECK(buf[0] == base_fill(100));
+
+    for (uint32_t n = 0; n < OVERLAY_BLOCKS; n++) {
+        memset(data, n, sizeof(data));
+        CHECK(dev.write(&dev, 1000 + (n * 8), data) == 0);
+    }
+    // full: rewriting a sector already in the overlay still works, a new one doesn't
+    memset(data, 0xee, sizeof(data));
+    CHECK(dev.write(&dev, 1000, data) == 0);
+    CHECK(dev.write(&dev, 999, data) != 0);
+
+    CHECK(dev.read(&dev, 1000, buf) == 0);
+    CHECK((buf[0] == 0xee) && (buf[BLOCK_DEVICE_BLOCK_SIZE - 1] == 0xee));
+    for (uint32_t n = 1; n < OVERLAY_BLOCKS; n++) {
+        CHECK(dev.read(&dev, 1000 + (n * 8), buf) == 0);
+        CHECK(buf[0] == (uint8_t)n);
+    }
+    CHECK(dev.read(&dev, 1001, buf) == 0);
+    CHECK(buf[0] == base_fill(1001));
+
+    // a pool block that changed behind the overlay's back reads as an error
+    overlay.pool[overlay.slots[overlay_find(&overlay, 1008)]][17] ^= 1;
+    CHECK(dev.read(&dev, 1008, buf) != 0);
+
+    dev.revert(&dev);
+    CHECK(dev.read(&dev, 1000, buf) == 0);
+    CHECK(buf[0] == base_fill(1000));
+    CHECK(dev.write(&dev, 999, data) == 0);
+}
+
+/**
+ * Fills the pool with pattern(n) for n = 0, 1, ... and reports the probes taken by lookups of
+ * everything in it and of BASE_BLOCKS LBAs that mostly aren't.
+ */
+static void measure(const char *name, uint32_t (*pattern)(uint32_t))
+{
+    dev.revert(&dev);
+    for (uint32_t n = 0; overlay.used < OVERLAY_BLOCKS; n++) {
+        CHECK(dev.write(&dev, pattern(n) % BASE_BLOCKS, buf) == 0);
+    }
+
+    uint32_t hit_total = 0, hit_max = 0;
+    for (uint32_t i = 0; i < OVERLAY_HASH_SIZE; i++) {
+        if (overlay.keys[i] != OVERLAY_EMPTY) {
+            const uint32_t p = probes(overlay.keys[i]);
+            hit_total += p;
+            hit_max = (p > hit_max) ? p : hit_max;
+        }
+    }
+
+    uint32_t miss_total = 0, miss_max = 0, misses = 0;
+    for (uint32_t lba = 0; lba < BASE_BLOCKS; lba++) {
+        if (overlay.keys[overlay_find(&overlay, lba)] != lba) {
+            const uint32_t p = probes(lba);
+            miss_total += p;
+            miss_max = (p > miss_max) ? p : miss_max;
+            misses++;
+        }
+    }
+
+    struct timespec t0, t1;
+    volatile uint32_t sink = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int pass = 0; pass < 64; pass++) {
+        for (uint32_t lba = 0; lba < BASE_BLOCKS; lba++) {
+            sink += overlay_find(&overlay, lba);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    const double ns = ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) /
+                      (64.0 * BASE_BLOCKS);
+
+    const double hit_mean = (double)hit_total / OVERLAY_BLOCKS;
+    const double miss_mean = (double)miss_total / misses;
+    printf("%-10s hit %.2f avg %2u max   miss %.2f avg %2u max   %.1f ns/lookup\n",
+           name, hit_mean, hit_max, miss_mean, miss_max, ns);
+    CHECK(hit_mean <= 2.0);
+    CHECK(miss_mean <= 3.5);
+    CHECK(hit_max <= 12);
+    CHECK(miss_max <= 16);
+}
+
+// a file written a sector at a time, clusters of a freshly formatted volume, the FAT and directory
+// updates that go with them, and no pattern at all
+static uint32_t sequential(uint32_t n)
+{
+    return 2048 + n;
+}
+
+static uint32_t cluster(uint32_t n)
+{
+    return 4096 + (n * 8);
+}
+
+static uint32_t big_cluster(uint32_t n)
+{
+    return 4096 + (n * 64);
+}
+
+static uint32_t metadata(uint32_t n)
+{
+    return (n & 1) ? (1 + (n / 2)) : (640 + (n / 2) * 32);
+}
+
+static uint32_t scattered(uint32_t n)
+{
+    return n * 40503u + (n >> 3) * 7919u;
+}
+
+int main(void)
+{
+    overlay_init(&dev, &base);
+    test_correctness();
+
+    printf("%d pool blocks, %d table entries\n", OVERLAY_BLOCKS, OVERLAY_HASH_SIZE);
+    measure("sequential", sequential);
+    measure("cluster", cluster);
+    measure("cluster64", big_cluster);
+    measure("metadata", metadata);
+    measure("scattered", scattered);
+    printf("ok\n");
+    return 0;
+}
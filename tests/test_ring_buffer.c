@@ -0,0 +1,168 @@
+#include "ring_buffer.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * One producer thread and one consumer thread push a known byte sequence through the ring in
+ * chunks of random sizes, through both the span and the copying APIs, and the consumer checks
+ * every byte comes out once and in order. Ring sizes start tiny so the indices wrap the storage
+ * constantly; starting them near 2^32 makes them wrap the counters too.
+ */
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1); \
+        } \
+    } while (0)
+
+#define STRESS_BYTES (4u << 20)
+
+static ring_buffer_t rb;
+
+static uint8_t sequence(uint32_t n)
+{
+    return (uint8_t)((n * 2654435761u) >> 24);
+}
+
+// xorshift, one state per thread
+static uint32_t next_random(uint32_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static void *producer(void *arg)
+{
+    uint32_t seed = 1;
+    uint32_t sent = 0;
+    uint8_t chunk[97];
+
+    while (sent < STRESS_BYTES) {
+        uint32_t n = 1 + (next_random(&seed) % sizeof(chunk));
+        if (n > (STRESS_BYTES - sent)) {
+            n = STRESS_BYTES - sent;
+        }
+
+        if (next_random(&seed) & 1) {
+            for (uint32_t i = 0; i < n; i++) {
+                chunk[i] = sequence(sent + i);
+            }
+            n = ring_buffer_write(&rb, chunk, n);
+        } else {
+            uint8_t *span;
+            const uint32_t room = ring_buffer_write_span(&rb, &span);
+            if (n > room) {
+                n = room;
+            }
+            for (uint32_t i = 0; i < n; i++) {
+                span[i] = sequence(sent + i);
+            }
+            ring_buffer_write_commit(&rb, n);
+        }
+
+        sent += n;
+        if (n == 0) {
+            sched_yield();
+        }
+    }
+    return 0;
+}
+
+static void *consumer(void *arg)
+{
+    uint32_t seed = 2;
+    uint32_t received = 0;
+
+    while (received < STRESS_BYTES) {
+        const uint8_t *span;
+        uint32_t n = ring_buffer_read_span(&rb, &span);
+        const uint32_t want = 1 + (next_random(&seed) % 113);
+        if (n > want) {
+            n = want;
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            CHECK(span[i] == sequence(received + i));
+        }
+        ring_buffer_read_commit(&rb, n);
+
+        received += n;
+        if (n == 0) {
+            sched_yield();
+        }
+    }
+    return 0;
+}
+
+static void stress(uint32_t size, uint32_t start)
+{
+    uint8_t *space = malloc(size);
+    pthread_t p, c;
+
+    ring_buffer_init(&rb, space, size);
+    rb.head = start;
+    rb.tail = start;
+
+    CHECK(pthread_create(&c, 0, consumer, 0) == 0);
+    CHECK(pthread_create(&p, 0, producer, 0) == 0);
+    CHECK(pthread_join(p, 0) == 0);
+    CHECK(pthread_join(c, 0) == 0);
+
+    CHECK(rb.head == rb.tail);
+    CHECK(ring_buffer_free(&rb) == size);
+    free(space);
+    printf("%5u byte ring: %u bytes ok\n", size, STRESS_BYTES);
+}
+
+/**
+ * Single-threaded edge cases: a full ring takes nothing more, spans stop at the end of the
+ * storage, and the whole storage is usable.
+ */
+static void edges(void)
+{
+    uint8_t space[16];
+    uint8_t data[32];
+    uint8_t *wspan;
+    const uint8_t *rspan;
+
+    for (int i = 0; i < 32; i++) {
+        data[i] = i;
+    }
+    ring_buffer_init(&rb, space, sizeof(space));
+
+    CHECK(ring_buffer_write(&rb, data, 32) == 16);
+    CHECK(ring_buffer_free(&rb) == 0);
+    CHECK(ring_buffer_write_span(&rb, &wspan) == 0);
+    CHECK(ring_buffer_write(&rb, data, 1) == 0);
+
+    CHECK(ring_buffer_read_span(&rb, &rspan) == 16);
+    CHECK(memcmp(rspan, data, 16) == 0);
+    ring_buffer_read_commit(&rb, 10);
+
+    // 10 free, but only 0..9 at the start of the storage; the next span ends at the storage's end
+    CHECK(ring_buffer_write(&rb, &data[16], 10) == 10);
+    CHECK(ring_buffer_read_span(&rb, &rspan) == 6);
+    CHECK(memcmp(rspan, &data[10], 6) == 0);
+    ring_buffer_read_commit(&rb, 6);
+    CHECK(ring_buffer_read_span(&rb, &rspan) == 10);
+    CHECK(memcmp(rspan, &data[16], 10) == 0);
+    ring_buffer_read_commit(&rb, 10);
+    CHECK(ring_buffer_read_span(&rb, &rspan) == 0);
+    CHECK(ring_buffer_free(&rb) == 16);
+}
+
+int main(void)
+{
+    edges();
+    stress(16, 0);
+    stress(64, 0xffffff00u);
+    stress(1024, 0);
+    printf("ok\n");
+    return 0;
+}
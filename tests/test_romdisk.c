@@ -0,0 +1,108 @@
+#include "romdisk.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Checks romdisk_read against the volume mkromdisk.py compressed (romdisk_image.c and the --raw
+ * copy next to it), then feeds it every truncation and a spread of single-byte corruptions of
+ * every compressed sector, each in a buffer of exactly its own size. Built with AddressSanitizer,
+ * so reading a byte past the sector or writing past the block fails the test.
+ */
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1); \
+        } \
+    } while (0)
+
+typedef struct romdisk_header
+{
+    uint32_t magic;
+    uint32_t block_count;
+    uint32_t index[];
+} romdisk_header_t;
+
+static uint8_t *load(const char *path, long *size)
+{
+    FILE *f = fopen(path, "rb");
+    CHECK(f);
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(*size);
+    CHECK(fread(data, 1, *size, f) == (size_t)*size);
+    fclose(f);
+    return data;
+}
+
+/**
+ * Decodes len bytes of compressed data as a one-sector ROM disk whose data ends exactly where the
+ * allocation does.
+ */
+static int read_alone(block_device_t *dev, const uint8_t *data, uint32_t len, uint8_t *out)
+{
+    const uint32_t header = sizeof(romdisk_header_t) + (2 * sizeof(uint32_t));
+    romdisk_header_t *hdr = malloc(header + len);
+    hdr->magic = ROMDISK_MAGIC;
+    hdr->block_count = 1;
+    hdr->index[0] = 0;
+    hdr->index[1] = len;
+    memcpy((uint8_t *)hdr + header, data, len);
+
+    void *const ctx = dev->ctx;
+    dev->ctx = hdr;
+    const int ret = dev->read(dev, 0, out);
+    dev->ctx = ctx;
+    free(hdr);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    long raw_size;
+    uint8_t *raw = load((argc > 1) ? argv[1] : "romdisk_raw.bin", &raw_size);
+    block_device_t dev;
+    romdisk_init(&dev);
+    CHECK(dev.block_count == (raw_size / BLOCK_DEVICE_BLOCK_SIZE));
+
+    uint8_t *out = malloc(BLOCK_DEVICE_BLOCK_SIZE);
+    for (uint32_t lba = 0; lba < dev.block_count; lba++) {
+        CHECK(dev.read(&dev, lba, out) == 0);
+        CHECK(memcmp(out, &raw[lba * BLOCK_DEVICE_BLOCK_SIZE], BLOCK_DEVICE_BLOCK_SIZE) == 0);
+    }
+
+    const romdisk_header_t *hdr = dev.ctx;
+    const uint8_t *data = (const uint8_t *)&hdr->index[hdr->block_count + 1];
+    uint32_t seed = 1;
+    uint32_t compressed = 0;
+    for (uint32_t lba = 0; lba < dev.block_count; lba++) {
+        const uint8_t *sector = &data[hdr->index[lba]];
+        const uint32_t len = hdr->index[lba + 1] - hdr->index[lba];
+        if ((len == 0) || (len == BLOCK_DEVICE_BLOCK_SIZE)) {
+            continue;
+        }
+        compressed++;
+
+        CHECK(read_alone(&dev, sector, len, out) == 0);
+        for (uint32_t n = 1; n < len; n++) {
+            CHECK(read_alone(&dev, sector, n, out) != 0);
+        }
+
+        // whatever comes of it, nothing may be touched outside the sector and the block
+        uint8_t *bad = malloc(len);
+        for (int i = 0; i < 16; i++) {
+            seed = (seed * 1103515245) + 12345;
+            memcpy(bad, sector, len);
+            bad[(seed >> 8) % len] = (i & 1) ? 0xff : (seed >> 16);
+            read_alone(&dev, bad, len, out);
+        }
+        free(bad);
+    }
+    printf("%u blocks, %u compressed: ok\n", dev.block_count, compressed);
+    free(out);
+    free(raw);
+    return 0;
+}
@@ -0,0 +1,270 @@
+#include "scsi.h"
+#include "serial_number.h"
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * The bulk-only transport's CBW checks: a packet that isn't exactly 31 bytes with the CBW
+ * signature has to be STALLed without touching the SCSI state around the CBW. Clearing the halt
+ * that leaves on the IN endpoint mustn't send anything or wedge the state machine, and the next
+ * good CBW still has to be answered, as it does after a Bulk-Only Mass Storage Reset mid-command.
+ * The vendor revert has to refuse a locked medium, WRITE SAME and VERIFY have to stick to the
+ * limit on how much work they do in the interrupt, and a LUN whose medium is empty or can't be
+ * read has to say there's no medium.
+ */
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1); \
+        } \
+    } while (0)
+
+#define DISK_BLOCKS 64
+
+void stats_command(uint8_t opcode)
+{
+    (void)opcode;
+}
+
+void stats_report(uint8_t *buf)
+{
+    (void)buf;
+}
+
+void serial_number_hex(char *buf)
+{
+    memset(buf, '0', 32);
+}
+
+static int reads;
+static int writes;
+static int reverts;
+
+static int disk_read(const block_device_t *dev, uint32_t lba, uint8_t *buf)
+{
+    (void)dev;
+    reads++;
+    memset(buf, (uint8_t)lba, BLOCK_DEVICE_BLOCK_SIZE);
+    return 0;
+}
+
+static int disk_write(const block_device_t *dev, uint32_t lba, const uint8_t *buf)
+{
+    (void)dev;
+    (void)lba;
+    (void)buf;
+    writes++;
+    return 0;
+}
+
+static int disk_revert(const block_device_t *dev)
+{
+    (void)dev;
+    reverts++;
+    return 0;
+}
+
+static const block_device_t disk = {
+    .block_count = DISK_BLOCKS, .read = disk_read, .write = disk_write, .revert = disk_revert
+};
+// what romdisk_init gives for a bad image, and vfat_init for a size it can't do
+static block_device_t empty = { .block_count = 0, .read = disk_read };
+
+static scsi_state_t state;
+static uint8_t cbw_lun;
+static uint8_t cbw_prevent;
+static uint16_t cbw_blocks = 1;
+static uint8_t out_buf[64];
+static uint8_t in_buf[64];
+static uint8_t response[64];
+
+/**
+ * Sends a CBW for a command with no data stage in a packet of nbytes, padded with 0xa5.
+ */
+static int32_t send_cbw(uint32_t signature, uint32_t tag, uint8_t nbytes, uint8_t opcode,
+                        int32_t data_length)
+{
+    usb_mass_storage_cbw_t cbw = { 0 };
+    cbw.cbw_signature = signature;
+    cbw.cbw_tag = tag;
+    cbw.cbw_data_transfer_length = data_length;
+    cbw.cbw_flags = ((opcode == 0x2a) || (opcode == 0x41)) ? 0 : USB_MASS_STORAGE_CBW_FLAG_IN;
+    cbw.cbw_lun = cbw_lun;
+    cbw.cbwcb_length = 10;
+    cbw.cbwcb[0] = opcode;
+    if (opcode == 0x9e) {
+        cbw.cbwcb[1] = 0x10;            // READ CAPACITY(16)
+    } else if (opcode == 0x1e) {
+        cbw.cbwcb[4] = cbw_prevent;     // PREVENT ALLOW MEDIUM REMOVAL
+    } else if (opcode == 0x12) {
+        cbw.cbwcb[1] = 0x01;            // INQUIRY of the Block Limits VPD page
+        cbw.cbwcb[2] = 0xb0;
+        cbw.cbwcb[4] = data_length;
+    }
+    cbw.cbwcb[7] = cbw_blocks >> 8;
+    cbw.cbwcb[8] = cbw_blocks;
+    memset(out_buf, 0xa5, sizeof(out_buf));
+    memcpy(out_buf, &cbw, sizeof(cbw));
+    return scsi_handle(&state, USB_TRANSFER_DIRECTION_OUT, out_buf, nbytes, in_buf);
+}
+
+static int32_t send_tur(uint32_t tag, uint8_t nbytes)
+{
+    return send_cbw(USB_MASS_STORAGE_CBW_SIGNATURE, tag, nbytes, 0x00, 0);
+}
+
+/**
+ * What main.c does for CLEAR_FEATURE(ENDPOINT_HALT) on the IN endpoint.
+ */
+static int32_t clear_halt_in(void)
+{
+    return scsi_handle(&state, USB_TRANSFER_DIRECTION_IN, out_buf, 0, in_buf);
+}
+
+/**
+ * Runs a whole command on cbw_lun the way a host would: clearing the halt after a STALL, and
+ * sending zeros for a WRITE(10) or WRITE SAME(10). Returns the CSW status, with the last data
+ * packet it got back in response.
+ */
+static uint8_t command(uint32_t tag, uint8_t opcode, int32_t data_length)
+{
+    int32_t sent = send_cbw(USB_MASS_STORAGE_CBW_SIGNATURE, tag, sizeof(usb_mass_storage_cbw_t),
+                            opcode, data_length);
+    while (state.current_state != CBW_FLOW_CSW_PENDING_STATE) {
+        if (state.current_state == CBW_FLOW_EXPECTING_DATA_OUT_STATE) {
+            CHECK(sent == -1);
+            memset(out_buf, 0, sizeof(out_buf));
+            sent = scsi_handle(&state, USB_TRANSFER_DIRECTION_OUT, out_buf, sizeof(out_buf),
+                               in_buf);
+        } else {
+            CHECK(sent != -1);
+            if (sent > 0) {
+                memcpy(response, in_buf, sent);
+            }
+            sent = scsi_handle(&state, USB_TRANSFER_DIRECTION_IN, out_buf, 0, in_buf);
+        }
+    }
+
+    usb_mass_storage_csw_t csw;
+    CHECK(sent == sizeof(csw));
+    memcpy(&csw, in_buf, sizeof(csw));
+    CHECK(memcmp(csw.csw_signature, "USBS", 4) == 0);
+    CHECK(csw.csw_tag == tag);
+    CHECK(scsi_handle(&state, USB_TRANSFER_DIRECTION_IN, out_buf, 0, in_buf) == -1);
+    return csw.csw_status;
+}
+
+/**
+ * Checks that a command fails on cbw_lun with NOT READY, MEDIUM NOT PRESENT.
+ */
+static void check_not_present(uint32_t tag, uint8_t opcode, int32_t data_length)
+{
+    CHECK(command(tag, opcode, data_length) == 1);
+    CHECK(command(tag + 1, 0x03, 18) == 0);     // REQUEST SENSE
+    CHECK((response[2] & 0x0f) == SCSI_SENSE_KEY_NOT_READY);
+    CHECK(response[12] == SCSI_ASC_MEDIUM_NOT_PRESENT);
+}
+
+static void check_csw(int32_t sent, uint32_t tag)
+{
+    usb_mass_storage_csw_t csw;
+    CHECK(sent == sizeof(csw));
+    memcpy(&csw, in_buf, sizeof(csw));
+    CHECK(memcmp(csw.csw_signature, "USBS", 4) == 0);
+    CHECK(csw.csw_tag == tag);
+    CHECK(csw.csw_status == 0);
+    CHECK(scsi_handle(&state, USB_TRANSFER_DIRECTION_IN, out_buf, 0, in_buf) == -1);
+    CHECK(state.current_state == CBW_FLOW_EXPECTING_CBW_STATE);
+}
+
+int main(void)
+{
+    scsi_init(&state);
+    CHECK(scsi_add_lun(&state, &disk, BLOCK_DEVICE_BLOCK_SHIFT, 0) == 0);
+    check_csw(send_tur(1, sizeof(usb_mass_storage_cbw_t)), 1);
+
+    const scsi_state_t before = state;
+    for (uint32_t nbytes = 0; nbytes <= sizeof(out_buf); nbytes++) {
+        if (nbytes == sizeof(usb_mass_storage_cbw_t)) {
+            continue;
+        }
+        CHECK(send_tur(2, nbytes) == -2);
+        CHECK(memcmp(&state, &before, sizeof(state)) == 0);
+        CHECK(clear_halt_in() == -1);
+        CHECK(memcmp(&state, &before, sizeof(state)) == 0);
+    }
+    check_csw(send_tur(3, sizeof(usb_mass_storage_cbw_t)), 3);
+
+    CHECK(send_cbw(0x43425356, 4, sizeof(usb_mass_storage_cbw_t), 0x00, 0) == -2);
+    CHECK(clear_halt_in() == -1);
+    CHECK(state.current_state == CBW_FLOW_EXPECTING_CBW_STATE);
+    check_csw(send_tur(5, sizeof(usb_mass_storage_cbw_t)), 5);
+
+    // READ(10) of one block, abandoned after its first packet
+    CHECK(send_cbw(USB_MASS_STORAGE_CBW_SIGNATURE, 6, sizeof(usb_mass_storage_cbw_t), 0x28,
+                   BLOCK_DEVICE_BLOCK_SIZE) == 64);
+    CHECK(state.current_state != CBW_FLOW_EXPECTING_CBW_STATE);
+    scsi_reset(&state);
+    check_csw(send_tur(7, sizeof(usb_mass_storage_cbw_t)), 7);
+
+    // The vendor revert has to leave a medium the host has locked alone.
+    CHECK(command(20, 0xc0, 0) == 0);
+    CHECK(command(21, 0x00, 0) == 1);       // UNIT ATTENTION after the medium changed
+    CHECK(reverts == 1);
+    cbw_prevent = 1;
+    CHECK(command(22, 0x1e, 0) == 0);
+    CHECK(command(23, 0xc0, 0) == 1);
+    CHECK(reverts == 1);
+    CHECK(command(24, 0x03, 18) == 0);
+    CHECK((response[2] & 0x0f) == SCSI_SENSE_KEY_NOT_READY);
+    CHECK((response[12] == SCSI_ASC_MEDIUM_REMOVAL_PREVENTED) &&
+          (response[13] == SCSI_ASCQ_MEDIUM_REMOVAL_PREVENTED));
+    cbw_prevent = 0;
+    CHECK(command(25, 0x1e, 0) == 0);
+    CHECK(command(26, 0xc0, 0) == 0);
+    CHECK(reverts == 2);
+    CHECK(command(27, 0x00, 0) == 1);
+
+    // WRITE SAME and VERIFY run inside the interrupt, so they're capped, and the host is told.
+    CHECK(command(30, 0x12, 64) == 0);
+    CHECK(response[1] == 0xb0);
+    CHECK(((response[40] << 24) | (response[41] << 16) | (response[42] << 8) | response[43]) ==
+          SCSI_ISR_BLOCKS_MAX);
+    cbw_blocks = SCSI_ISR_BLOCKS_MAX;
+    CHECK(command(31, 0x41, BLOCK_DEVICE_BLOCK_SIZE) == 0);
+    CHECK(writes == SCSI_ISR_BLOCKS_MAX);
+    reads = 0;
+    CHECK(command(32, 0x2f, 0) == 0);
+    CHECK(reads == SCSI_ISR_BLOCKS_MAX);
+    cbw_blocks = SCSI_ISR_BLOCKS_MAX + 1;
+    static const uint8_t capped[] = { 0x2f, 0x41 };     // VERIFY(10), WRITE SAME(10)
+    for (uint32_t i = 0; i < sizeof(capped); i++) {
+        CHECK(command(33, capped[i], (capped[i] == 0x41) ? BLOCK_DEVICE_BLOCK_SIZE : 0) == 1);
+        CHECK(command(34, 0x03, 18) == 0);
+        CHECK((response[2] & 0x0f) == SCSI_SENSE_KEY_ILLEGAL_REQUEST);
+        CHECK(response[12] == SCSI_ASC_INVALID_FIELD_IN_CDB);
+    }
+    CHECK((writes == SCSI_ISR_BLOCKS_MAX) && (reads == SCSI_ISR_BLOCKS_MAX));
+    cbw_blocks = 1;
+
+    // An empty medium has to look absent, not like a disk whose last LBA is 0xffffffff.
+    CHECK(command(8, 0x25, 8) == 0);
+    CHECK(response[3] == (DISK_BLOCKS - 1));
+    CHECK(scsi_add_lun(&state, &empty, BLOCK_DEVICE_BLOCK_SHIFT, 0) == 1);
+    cbw_lun = 1;
+    for (int pass = 0; pass < 2; pass++) {
+        check_not_present(10, 0x00, 0);                             // TEST UNIT READY
+        check_not_present(12, 0x25, 8);                             // READ CAPACITY(10)
+        check_not_present(14, 0x9e, 32);                            // READ CAPACITY(16)
+        check_not_present(16, 0x28, BLOCK_DEVICE_BLOCK_SIZE);       // READ(10)
+        check_not_present(18, 0x2a, BLOCK_DEVICE_BLOCK_SIZE);       // WRITE(10)
+        empty = (block_device_t) { .block_count = DISK_BLOCKS };
+    }
+
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,255 @@
+#include "nvm.h"
+#include "uf2.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Feeds uf2_write whole UF2 files out of order and with repeats, and blocks it has to turn away,
+ * against a simulated flash array in place of the NVM controller.
+ */
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1); \
+        } \
+    } while (0)
+
+static uint8_t flash[UF2_APP_END];
+static uint32_t erases[UF2_APP_END / NVM_ROW_SIZE];
+static uint32_t total_erases;
+
+int nvm_erase_row(uint32_t addr)
+{
+    CHECK((addr % NVM_ROW_SIZE) == 0);
+    CHECK((addr >= UF2_APP_START) && (addr < UF2_APP_END));
+    memset(&flash[addr], 0xff, NVM_ROW_SIZE);
+    erases[addr / NVM_ROW_SIZE]++;
+    total_erases++;
+    return 0;
+}
+
+int nvm_write_page(uint32_t addr, const uint8_t *data)
+{
+    CHECK((addr % NVM_PAGE_SIZE) == 0);
+    CHECK((addr >= UF2_APP_START) && (addr < UF2_APP_END));
+    // programming can only clear bits
+    for (int i = 0; i < NVM_PAGE_SIZE; i++) {
+        flash[addr + i] &= data[i];
+    }
+    return 0;
+}
+
+static int base_read(const block_device_t *dev, uint32_t lba, uint8_t *buf)
+{
+    memset(buf, 0, BLOCK_DEVICE_BLOCK_SIZE);
+    return 0;
+}
+
+static const block_device_t base = { .block_count = 16384, .read = base_read };
+static block_device_t dev;
+
+static uint8_t payload(uint32_t file, uint32_t block_no, uint32_t i)
+{
+    return (uint8_t)((file * 131) + (block_no * 7) + i);
+}
+
+static uf2_block_t make_block(uint32_t file, uint32_t addr, uint32_t block_no,
+                              uint32_t num_blocks)
+{
+    uf2_block_t b;
+    memset(&b, 0, sizeof(b));
+    b.magic_start0 = UF2_MAGIC_START0;
+    b.magic_start1 = UF2_MAGIC_START1;
+    b.magic_end = UF2_MAGIC_END;
+    b.flags = UF2_FLAG_FAMILY_ID_PRESENT;
+    b.family_id = UF2_FAMILY_ID_SAMD21;
+    b.target_addr = addr + (block_no * NVM_ROW_SIZE);
+    b.payload_size = NVM_ROW_SIZE;
+    b.block_no = block_no;
+    b.num_blocks = num_blocks;
+    for (uint32_t i = 0; i < NVM_ROW_SIZE; i++) {
+        b.data[i] = payload(file, block_no, i);
+    }
+    return b;
+}
+
+static int write_block(const uf2_block_t *b, uint32_t lba)
+{
+    return dev.write(&dev, lba, (const uint8_t *)b);
+}
+
+static void check_programmed(uint32_t file, uint32_t addr, uint32_t num_blocks)
+{
+    for (uint32_t n = 0; n < num_blocks; n++) {
+        CHECK(erases[(addr / NVM_ROW_SIZE) + n] == 1);
+        for (uint32_t i = 0; i < NVM_ROW_SIZE; i++) {
+            CHECK(flash[addr + (n * NVM_ROW_SIZE) + i] == payload(file, n, i));
+        }
+    }
+}
+
+static void reset_flash(void)
+{
+    memset(flash, 0xff, sizeof(flash));
+    memset(erases, 0, sizeof(erases));
+    total_erases = 0;
+}
+
+/**
+ * Every block of a file lands in a shuffled order, each one twice, at whatever LBA the host picked.
+ */
+static void test_out_of_order_and_duplicates(void)
+{
+    enum { N = 64 };
+    uint32_t order[N];
+    reset_flash();
+
+    for (uint32_t i = 0; i < N; i++) {
+        order[i] = i;
+    }
+    srand(1);
+    for (uint32_t i = N - 1; i > 0; i--) {
+        const uint32_t j = rand() % (i + 1);
+        const uint32_t t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+
+    for (uint32_t i = 0; i < N; i++) {
+        const uf2_block_t b = make_block(1, UF2_APP_START, order[i], N);
+        CHECK(!uf2_complete());
+        CHECK(write_block(&b, 1000 + i) == 0);
+        // the host rewriting the same sector, and a copy of it turning up somewhere else
+        CHECK(write_block(&b, 1000 + i) == 0);
+        CHECK(write_block(&b, 7) == 0);
+    }
+    CHECK(uf2_complete());
+    CHECK(total_erases == N);
+    check_programmed(1, UF2_APP_START, N);
+
+    // a repeat after completion changes nothing
+    const uf2_block_t again = make_block(1, UF2_APP_START, 3, N);
+    CHECK(write_block(&again, 0) == 0);
+    CHECK(total_erases == N);
+    CHECK(uf2_complete());
+}
+
+/**
+ * Blocks for other chips, other memories or addresses outside the application region are
+ * acknowledged to the host but never programmed, and don't disturb the file in progress.
+ */
+static void test_rejected_blocks(void)
+{
+    enum { N = 4 };
+    reset_flash();
+
+    uf2_block_t b = make_block(2, UF2_APP_START, 0, N);
+    CHECK(write_block(&b, 0) == 0);
+    CHECK(total_erases == 1);
+
+    b = make_block(2, UF2_APP_START, 1, N);
+    b.family_id = 0xe48bff56;
+    CHECK(write_block(&b, 0) == 0);
+
+    b = make_block(2, UF2_APP_START, 1, N);
+    b.flags |= UF2_FLAG_NOT_MAIN_FLASH;
+    CHECK(write_block(&b, 0) == 0);
+
+    // below the application (over the bootloader itself), past the end of flash, misaligned
+    b = make_block(2, UF2_APP_START - NVM_ROW_SIZE, 0, N);
+    b.block_no = 1;
+    CHECK(write_block(&b, 0) == 0);
+    b = make_block(2, UF2_APP_END, 1, N);
+    CHECK(write_block(&b, 0) == 0);
+    b = make_block(2, UF2_APP_START + 4, 1, N);
+    CHECK(write_block(&b, 0) == 0);
+
+    // block number out of range for its own file, and a payload that isn't a whole row
+    b = make_block(2, UF2_APP_START, N, N);
+    CHECK(write_block(&b, 0) == 0);
+    b = make_block(2, UF2_APP_START, 1, N);
+    b.payload_size = 476;
+    CHECK(write_block(&b, 0) == 0);
+
+    // not a UF2 block at all (e.g. a FAT sector)
+    b = make_block(2, UF2_APP_START, 1, N);
+    b.magic_end = 0;
+    CHECK(write_block(&b, 0) == 0);
+
+    CHECK(total_erases == 1);
+    CHECK(!uf2_complete());
+
+    for (uint32_t n = 1; n < N; n++) {
+        b = make_block(2, UF2_APP_START, n, N);
+        CHECK(write_block(&b, 0) == 0);
+    }
+    CHECK(uf2_complete());
+    check_programmed(2, UF2_APP_START, N);
+}
+
+/**
+ * A block with a different num_blocks means the host started on another file; the count starts
+ * over and the first file's blocks don't count towards the second.
+ */
+static void test_changed_num_blocks(void)
+{
+    enum { A = 6, B = 3 };
+    reset_flash();
+
+    for (uint32_t n = 0; n < B; n++) {
+        const uf2_block_t b = make_block(3, UF2_APP_START, n, A);
+        CHECK(write_block(&b, 0) == 0);
+    }
+    CHECK(!uf2_complete());
+
+    for (uint32_t n = 0; n < B - 1; n++) {
+        const uf2_block_t b = make_block(4, UF2_APP_START + 0x4000, n, B);
+        CHECK(write_block(&b, 0) == 0);
+        CHECK(!uf2_complete());
+    }
+    const uf2_block_t last = make_block(4, UF2_APP_START + 0x4000, B - 1, B);
+    CHECK(write_block(&last, 0) == 0);
+    CHECK(uf2_complete());
+    check_programmed(4, UF2_APP_START + 0x4000, B);
+}
+
+/**
+ * Copying a file of the same size again after an aborted copy has to program every block of the
+ * new one, not skip the ones the first copy got to.
+ */
+static void test_copied_again(void)
+{
+    enum { N = 4 };
+    reset_flash();
+
+    for (uint32_t n = 0; n < N - 1; n++) {
+        const uf2_block_t b = make_block(5, UF2_APP_START, n, N);
+        CHECK(write_block(&b, 0) == 0);
+    }
+    CHECK(!uf2_complete());
+    memset(erases, 0, sizeof(erases));
+    total_erases = 0;
+
+    for (uint32_t n = 0; n < N; n++) {
+        const uf2_block_t b = make_block(6, UF2_APP_START, n, N);
+        CHECK(!uf2_complete());
+        CHECK(write_block(&b, 0) == 0);
+    }
+    CHECK(uf2_complete());
+    CHECK(total_erases == N);
+    check_programmed(6, UF2_APP_START, N);
+}
+
+int main(void)
+{
+    uf2_init(&dev, &base);
+    test_out_of_order_and_duplicates();
+    test_rejected_blocks();
+    test_changed_num_blocks();
+    test_copied_again();
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,74 @@
+#include "vfat.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * Works out the cluster count from the boot sector vfat_init produces the way a host does, and
+ * checks it's in FAT16's range, with clusters no bigger than 32 KiB and FATs big enough to hold
+ * it, for volume sizes from VFAT_MIN_BLOCKS to VFAT_MAX_BLOCKS (every size over the last 4096);
+ * anything outside that has to be refused.
+ */
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1); \
+        } \
+    } while (0)
+
+static uint32_t get16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return get16(p) | (get16(&p[2]) << 16);
+}
+
+static uint32_t host_clusters(const block_device_t *dev)
+{
+    uint8_t boot[BLOCK_DEVICE_BLOCK_SIZE];
+    CHECK(dev->read(dev, 0, boot) == 0);
+
+    const uint32_t total = get16(&boot[19]) ? get16(&boot[19]) : get32(&boot[32]);
+    const uint32_t root = (get16(&boot[17]) * 32) / BLOCK_DEVICE_BLOCK_SIZE;
+    const uint32_t data = get16(&boot[14]) + (boot[16] * get16(&boot[22])) + root;
+    CHECK(total == dev->block_count);
+    CHECK(data < total);
+    CHECK((boot[13] != 0) && (boot[13] <= (1 << VFAT_MAX_CLUSTER_SHIFT)));
+    CHECK((boot[13] & (boot[13] - 1)) == 0);
+    const uint32_t clusters = (total - data) / boot[13];
+    // two bytes per cluster, plus the two reserved entries
+    CHECK((get16(&boot[22]) * (BLOCK_DEVICE_BLOCK_SIZE / 2)) >= (clusters + 2));
+    return clusters;
+}
+
+int main(void)
+{
+    static const vfat_file_t files[] = { { "README  TXT", 5, (const uint8_t *)"hello", 0 } };
+    block_device_t dev;
+
+    for (uint32_t blocks = 0; blocks < VFAT_MIN_BLOCKS; blocks++) {
+        CHECK(vfat_init(&dev, files, 1, blocks) != 0);
+        CHECK(dev.block_count == 0);
+    }
+    for (uint32_t blocks = VFAT_MIN_BLOCKS; blocks <= VFAT_MAX_BLOCKS;
+         blocks += (blocks < (VFAT_MAX_BLOCKS - 4096)) ? 1 + (blocks >> 9) : 1) {
+        CHECK(vfat_init(&dev, files, 1, blocks) == 0);
+        const uint32_t clusters = host_clusters(&dev);
+        CHECK((clusters >= VFAT_MIN_CLUSTERS) && (clusters <= VFAT_MAX_CLUSTERS));
+    }
+    for (uint32_t blocks = VFAT_MAX_BLOCKS + 1; blocks < (1u << 24); blocks += 1 + (blocks >> 9)) {
+        CHECK(vfat_init(&dev, files, 1, blocks) != 0);
+        CHECK(dev.block_count == 0);
+    }
+    CHECK(vfat_init(&dev, files, 1, 0xffffffff) != 0);
+    CHECK(vfat_init(&dev, files, 1, VFAT_MIN_BLOCKS) == 0);
+    CHECK(host_clusters(&dev) == VFAT_MIN_CLUSTERS);
+    CHECK(vfat_init(&dev, files, 1, VFAT_MAX_BLOCKS) == 0);
+    CHECK(host_clusters(&dev) == VFAT_MAX_CLUSTERS);
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,33 @@
+#include "timestamp.h"
+
+#include "samd21.h"
+
+void timestamp_init(void)
+{
+    // TC4 is the master of the 32 bit pair; TC5 just supplies the top half.
+    PM->APBCMASK.reg |= PM_APBCMASK_TC4 | PM_APBCMASK_TC5;
+    GCLK->CLKCTRL.reg = (GCLK_CLKCTRL_CLKEN |
+                         GCLK_CLKCTRL_GEN_GCLK0 |
+                         GCLK_CLKCTRL_ID_TC4_TC5);
+    while (GCLK->STATUS.reg & GCLK_STATUS_SYNCBUSY);
+
+    TC4->COUNT32.CTRLA.reg = TC_CTRLA_SWRST;
+    while (TC4->COUNT32.CTRLA.reg & TC_CTRLA_SWRST);
+
+    TC4->COUNT32.CTRLA.reg = TC_CTRLA_MODE_COUNT32 | TC_CTRLA_PRESCALER_DIV1;
+
+    // Keep COUNT synchronized into the APB domain all the time, so reading it is a plain load
+    // instead of a read request and a wait for SYNCBUSY. It lags the counter by a few cycles.
+    TC4->COUNT32.READREQ.reg = (TC_READREQ_RCONT |
+                                TC_READREQ_RREQ |
+                                TC_READREQ_ADDR(TC_COUNT32_COUNT_OFFSET));
+    while (TC4->COUNT32.STATUS.reg & TC_STATUS_SYNCBUSY);
+
+    TC4->COUNT32.CTRLA.reg |= TC_CTRLA_ENABLE;
+    while (TC4->COUNT32.STATUS.reg & TC_STATUS_SYNCBUSY);
+}
+
+uint32_t timestamp_now(void)
+{
+    return TC4->COUNT32.COUNT.reg;
+}
@@ -0,0 +1,17 @@
+#ifndef TIMESTAMP_H
+#define TIMESTAMP_H
+
+#include <stdint.h>
+
+/**
+ * A free-running 32 bit count of core clock cycles, from TC4 and TC5 chained together. At 48 MHz
+ * it wraps about every 89 seconds; differences between two readings are right as long as they're
+ * taken closer together than that.
+ */
+#define TIMESTAMP_HZ 48000000
+
+void timestamp_init(void);
+
+uint32_t timestamp_now(void);
+
+#endif
@@ -0,0 +1,94 @@
+#!/usr/bin/env python3
+"""
+Reads the SCSI command latency histograms out of firmware built with LATENCY=1, using the
+vendor-specific command 0xc1 (see latency.h for the report layout), and prints them.
+
+For each opcode the device has seen, each phase gets its count, min / max, and the log2 histogram,
+with bucket edges converted to microseconds:
+
+    first data   CBW arrival to the first data packet
+    status       last data packet to the CSW
+    total        CBW arrival to the CSW
+
+usage: latency.py [--reset] DEVICE
+"""
+
+import argparse
+import os
+import struct
+import sys
+
+import sgio
+
+OPCODE = 0xc1
+FLAG_RESET = 0x01
+HEADER = struct.Struct("<BBBBBBBxII")
+PHASES = ["first data", "status", "total"]
+
+OPCODE_NAMES = {
+    0x00: "TEST UNIT READY", 0x03: "REQUEST SENSE", 0x12: "INQUIRY", 0x1a: "MODE SENSE(6)",
+    0x1b: "START STOP UNIT", 0x1e: "PREVENT ALLOW MEDIUM REMOVAL", 0x23: "READ FORMAT CAPACITIES",
+    0x25: "READ CAPACITY(10)", 0x28: "READ(10)", 0x2a: "WRITE(10)", 0x2f: "VERIFY(10)",
+    0x35: "SYNCHRONIZE CACHE(10)", 0x41: "WRITE SAME(10)", 0x42: "UNMAP", 0x5a: "MODE SENSE(10)",
+    0x88: "READ(16)", 0x8a: "WRITE(16)", 0x93: "WRITE SAME(16)", 0x9e: "SERVICE ACTION IN(16)",
+    0xc0: "VENDOR REVERT MEDIUM", 0xc1: "VENDOR LATENCY",
+}
+
+
+def read_slot(fd, slot):
+    cdb = bytes([OPCODE, 0, slot, 0, 0, 0, 0, 0, 0, 0])
+    return sgio.command(fd, cdb, 512)
+
+
+def print_slot(report):
+    (version, _, _, opcode, phases, buckets, min_log2, hz, _) = HEADER.unpack_from(report)
+    print("%02x %s" % (opcode, OPCODE_NAMES.get(opcode, "")))
+    us = 1e6 / hz
+    pos = HEADER.size
+    for phase in range(phases):
+        values = struct.unpack_from("<%dI" % (3 + buckets), report, pos)
+        pos += 4 * (3 + buckets)
+        count, lo, hi, hist = values[0], values[1], values[2], values[3:]
+        if not count:
+            continue
+        print("  %-10s  count %d  min %.1f us  max %.1f us" %
+              (PHASES[phase] if phase < len(PHASES) else phase, count, lo * us, hi * us))
+        for n, c in enumerate(hist):
+            if not c:
+                continue
+            lo_edge = (1 << (n + min_log2)) * us
+            if n == 0:
+                label = "%22s" % ("< %.1f us" % (2 * lo_edge))
+            elif n == buckets - 1:
+                label = "%22s" % (">= %.1f us" % lo_edge)
+            else:
+                label = "%22s" % ("%.1f - %.1f us" % (lo_edge, 2 * lo_edge))
+            print("    %s  %d" % (label, c))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Read the firmware's latency histograms.")
+    parser.add_argument("--reset", action="store_true", help="clear them after reading")
+    parser.add_argument("device", help="the drive's /dev/sg* or /dev/sd* node")
+    args = parser.parse_args()
+
+    fd = os.open(args.device, os.O_RDONLY)
+    try:
+        first = read_slot(fd, 0)
+        (version, slots, used, _, _, _, _, _, untracked) = HEADER.unpack_from(first)
+        if version != 1:
+            sys.exit("latency: don't know report version %d" % version)
+        for slot in range(used):
+            print_slot(first if slot == 0 else read_slot(fd, slot))
+        print("untracked commands: %d (%d slots)" % (untracked, slots))
+
+        if args.reset:
+            sgio.command(fd, bytes([OPCODE, FLAG_RESET, 0, 0, 0, 0, 0, 0, 0, 0]))
+    except sgio.ScsiError as e:
+        sys.exit("latency: %s (is the firmware built with LATENCY=1?)" % e)
+    finally:
+        os.close(fd)
+
+
+if __name__ == "__main__":
+    main()
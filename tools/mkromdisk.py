@@ -0,0 +1,403 @@
+#!/usr/bin/env python3
+"""
+Builds the read-only ROM disk that gets linked into flash when the firmware is built with
+MEDIUM=romdisk.
+
+The contents of a host directory are laid out as a FAT12/FAT16 volume, and then every 512 byte
+sector of that volume is compressed on its own so that the device can decompress any sector
+without touching its neighbours. The result is written out as a C source file holding one
+const array, romdisk_image[], whose layout is described in romdisk.h:
+
+    uint32_t magic             "RDSK"
+    uint32_t block_count
+    uint32_t index[block_count + 1]
+    uint8_t  data[]
+
+index[n] is the offset of sector n's compressed data relative to the start of data[], and
+index[n + 1] - index[n] is its length. A length of 0 means the sector is all zeros, and a
+length of 512 means it's stored raw because it didn't compress.
+
+Sectors are compressed with an LZ4-style block format: each sequence is a token byte (high
+nibble = literal count, low nibble = match length - 4, 15 in either meaning "more length bytes
+follow"), the literals, then a little endian 16 bit offset back into the sector. The final
+sequence has literals only.
+
+With --raw the uncompressed volume is written out as well, e.g. for tests/test_romdisk to check
+the device's decompressor against.
+
+usage: mkromdisk.py [--blocks N] [--label LABEL] [--raw IMAGE] SOURCE_DIR OUTPUT.c
+"""
+
+import argparse
+import os
+import struct
+import sys
+import time
+
+SECTOR_SIZE = 512
+ROOT_ENTRIES = 512
+RESERVED_SECTORS = 1
+NUM_FATS = 2
+MIN_MATCH = 4
+
+
+class Node:
+    def __init__(self, name, path, is_dir):
+        self.name = name
+        self.path = path
+        self.is_dir = is_dir
+        self.children = []
+        self.data = b""
+        self.mtime = 0
+        self.short_name = None
+        self.first_cluster = 0
+        self.nclusters = 0
+
+
+def scan(path, name=""):
+    node = Node(name, path, os.path.isdir(path))
+    node.mtime = os.stat(path).st_mtime
+    if node.is_dir:
+        for entry in sorted(os.listdir(path)):
+            if entry.startswith("."):
+                continue
+            node.children.append(scan(os.path.join(path, entry), entry))
+    else:
+        with open(path, "rb") as f:
+            node.data = f.read()
+    return node
+
+
+################################################################
+# names
+SHORT_NAME_CHARS = set("ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789!#$%&'()-@^_`{}~")
+
+
+def fits_short_name(name):
+    if name != name.upper():
+        return False
+    base, dot, ext = name.partition(".")
+    if ("." in ext) or (len(base) == 0) or (len(base) > 8) or (len(ext) > 3):
+        return False
+    return all(c in SHORT_NAME_CHARS for c in base + ext)
+
+
+def short_name_bytes(name):
+    base, _, ext = name.partition(".")
+    return (base.ljust(8) + ext.ljust(3)).encode("ascii")
+
+
+def assign_short_names(directory):
+    taken = set()
+    for child in directory.children:
+        if fits_short_name(child.name):
+            child.short_name = short_name_bytes(child.name)
+            taken.add(child.short_name)
+
+    for child in directory.children:
+        if child.short_name is not None:
+            continue
+        base, _, ext = child.name.rpartition(".") if "." in child.name else (child.name, "", "")
+        base = "".join(c for c in base.upper() if c in SHORT_NAME_CHARS) or "FILE"
+        ext = "".join(c for c in ext.upper() if c in SHORT_NAME_CHARS)[:3]
+        for n in range(1, 1000000):
+            tail = "~%d" % n
+            candidate = short_name_bytes(base[:8 - len(tail)] + tail + ("." + ext if ext else ""))
+            if candidate not in taken:
+                break
+        child.short_name = candidate
+        taken.add(candidate)
+
+    for child in directory.children:
+        if child.is_dir:
+            assign_short_names(child)
+
+
+def lfn_checksum(short_name):
+    s = 0
+    for b in short_name:
+        s = (((s & 1) << 7) + (s >> 1) + b) & 0xff
+    return s
+
+
+def lfn_entries(node):
+    if fits_short_name(node.name):
+        return []
+    units = list(node.name.encode("utf-16-le"))
+    units = [units[i] | (units[i + 1] << 8) for i in range(0, len(units), 2)]
+    if len(units) % 13:
+        units.append(0)
+    while len(units) % 13:
+        units.append(0xffff)
+
+    checksum = lfn_checksum(node.short_name)
+    count = len(units) // 13
+    entries = []
+    for seq in range(count, 0, -1):
+        chunk = units[(seq - 1) * 13:seq * 13]
+        order = seq | (0x40 if seq == count else 0)
+        entry = struct.pack("<B5HBBB6HH2H", order, *chunk[0:5], 0x0f, 0, checksum,
+                            *chunk[5:11], 0, *chunk[11:13])
+        entries.append(entry)
+    return entries
+
+
+def fat_datetime(mtime):
+    t = time.localtime(mtime)
+    year = min(max(t.tm_year, 1980), 2107)
+    date = ((year - 1980) << 9) | (t.tm_mon << 5) | t.tm_mday
+    tm = (t.tm_hour << 11) | (t.tm_min << 5) | (t.tm_sec // 2)
+    return date, tm
+
+
+def dir_entry(short_name, attr, cluster, size, mtime):
+    date, tm = fat_datetime(mtime)
+    return struct.pack("<11sBBBHHHHHHHI", short_name, attr, 0, 0, tm, date, date, 0,
+                       tm, date, cluster, size)
+
+
+def dir_entry_count(directory, is_root):
+    n = 0 if is_root else 2
+    for child in directory.children:
+        n += 1 + len(lfn_entries(child))
+    return n
+
+
+################################################################
+# layout
+def clusters_needed(directory, cluster_bytes, is_root):
+    n = 0
+    if not is_root:
+        directory.nclusters = max(1, -(-dir_entry_count(directory, False) * 32 // cluster_bytes))
+        n += directory.nclusters
+    for child in directory.children:
+        if child.is_dir:
+            n += clusters_needed(child, cluster_bytes, False)
+        else:
+            child.nclusters = -(-len(child.data) // cluster_bytes)
+            n += child.nclusters
+    return n
+
+
+def fat_sectors_for(clusters):
+    if clusters < 4085:
+        fat_bytes = -(-(clusters + 2) * 3 // 2)
+    else:
+        fat_bytes = (clusters + 2) * 2
+    return -(-fat_bytes // SECTOR_SIZE)
+
+
+def plan_geometry(root, min_blocks):
+    root_sectors = ROOT_ENTRIES * 32 // SECTOR_SIZE
+    for spc in (1, 2, 4, 8, 16, 32, 64):
+        needed = clusters_needed(root, spc * SECTOR_SIZE, True)
+        clusters = max(needed, 1)
+        fat_sectors = fat_sectors_for(clusters)
+        while True:
+            meta = RESERVED_SECTORS + NUM_FATS * fat_sectors + root_sectors
+            if min_blocks > meta:
+                clusters = max(needed, (min_blocks - meta) // spc)
+            new_fat_sectors = fat_sectors_for(clusters)
+            if new_fat_sectors == fat_sectors:
+                break
+            fat_sectors = new_fat_sectors
+        if clusters < 65525:
+            total = RESERVED_SECTORS + NUM_FATS * fat_sectors + root_sectors + clusters * spc
+            return spc, clusters, fat_sectors, root_sectors, max(total, min_blocks)
+    sys.exit("mkromdisk: source directory is too big for FAT16")
+
+
+def allocate(directory, next_cluster):
+    for child in directory.children:
+        if child.nclusters:
+            child.first_cluster = next_cluster
+            next_cluster += child.nclusters
+        if child.is_dir:
+            next_cluster = allocate(child, next_cluster)
+    return next_cluster
+
+
+def build_image(root, min_blocks, label):
+    assign_short_names(root)
+    spc, clusters, fat_sectors, root_sectors, total = plan_geometry(root, min_blocks)
+    fat16 = clusters >= 4085
+    cluster_bytes = spc * SECTOR_SIZE
+    allocate(root, 2)
+
+    image = bytearray(total * SECTOR_SIZE)
+    fat_start = RESERVED_SECTORS
+    root_start = fat_start + NUM_FATS * fat_sectors
+    data_start = root_start + root_sectors
+
+    # boot sector
+    label_bytes = label.upper().encode("ascii")[:11].ljust(11)
+    bs = struct.pack("<3s8sHBHBHHBHHHII", b"\xeb\x3c\x90", b"MSDOS5.0", SECTOR_SIZE, spc,
+                     RESERVED_SECTORS, NUM_FATS, ROOT_ENTRIES, total if total < 0x10000 else 0,
+                     0xf8, fat_sectors, 32, 64, 0, total if total >= 0x10000 else 0)
+    bs += struct.pack("<BBBI11s8s", 0x80, 0, 0x29, 0x524f4d21, label_bytes,
+                      b"FAT16   " if fat16 else b"FAT12   ")
+    image[0:len(bs)] = bs
+    image[510:512] = b"\x55\xaa"
+
+    # FAT
+    fat = [0] * (clusters + 2)
+    fat[0] = 0xfff8 if fat16 else 0xff8
+    fat[1] = 0xffff if fat16 else 0xfff
+    eoc = 0xffff if fat16 else 0xfff
+
+    def chain(node):
+        for i in range(node.nclusters):
+            c = node.first_cluster + i
+            fat[c] = eoc if i == node.nclusters - 1 else c + 1
+
+    def write_cluster_data(node, data):
+        offset = (data_start + (node.first_cluster - 2) * spc) * SECTOR_SIZE
+        image[offset:offset + len(data)] = data
+
+    def dir_blob(directory, parent_cluster, is_root):
+        blob = bytearray()
+        if is_root:
+            blob += dir_entry(label_bytes, 0x08, 0, 0, directory.mtime)
+        else:
+            blob += dir_entry(b".          ", 0x10, directory.first_cluster, 0, directory.mtime)
+            blob += dir_entry(b"..         ", 0x10, parent_cluster, 0, directory.mtime)
+        for child in directory.children:
+            for e in lfn_entries(child):
+                blob += e
+            attr = 0x10 if child.is_dir else 0x01
+            blob += dir_entry(child.short_name, attr, child.first_cluster,
+                              0 if child.is_dir else len(child.data), child.mtime)
+        return blob
+
+    def walk(directory, is_root):
+        for child in directory.children:
+            chain(child)
+            if child.is_dir:
+                write_cluster_data(child, dir_blob(child, 0 if is_root else directory.first_cluster,
+                                                   False))
+                walk(child, False)
+            elif child.data:
+                write_cluster_data(child, child.data)
+
+    root_blob = dir_blob(root, 0, True)
+    if len(root_blob) > ROOT_ENTRIES * 32:
+        sys.exit("mkromdisk: too many entries in the root directory")
+    image[root_start * SECTOR_SIZE:root_start * SECTOR_SIZE + len(root_blob)] = root_blob
+    walk(root, True)
+
+    if fat16:
+        fat_bytes = struct.pack("<%dH" % len(fat), *fat)
+    else:
+        fat_bytes = bytearray()
+        if len(fat) & 1:
+            fat.append(0)
+        for i in range(0, len(fat), 2):
+            a, b = fat[i], fat[i + 1]
+            fat_bytes += bytes([a & 0xff, ((a >> 8) & 0x0f) | ((b & 0x0f) << 4), b >> 4])
+    for n in range(NUM_FATS):
+        offset = (fat_start + n * fat_sectors) * SECTOR_SIZE
+        image[offset:offset + len(fat_bytes)] = fat_bytes
+
+    return bytes(image), total
+
+
+################################################################
+# compression
+def put_length(out, n):
+    while n >= 255:
+        out.append(255)
+        n -= 255
+    out.append(n)
+
+
+def emit_sequence(out, literals, offset, match_len):
+    lit = len(literals)
+    ml = (match_len - MIN_MATCH) if match_len else 0
+    token = (min(lit, 15) << 4) | min(ml, 15)
+    out.append(token)
+    if lit >= 15:
+        put_length(out, lit - 15)
+    out += literals
+    if match_len:
+        out += struct.pack("<H", offset)
+        if ml >= 15:
+            put_length(out, ml - 15)
+
+
+def compress_sector(sector):
+    n = len(sector)
+    out = bytearray()
+    table = {}
+    anchor = 0
+    i = 0
+    while i + MIN_MATCH <= n:
+        key = sector[i:i + MIN_MATCH]
+        cand = table.get(key)
+        table[key] = i
+        if cand is None:
+            i += 1
+            continue
+        m = MIN_MATCH
+        while (i + m < n) and (sector[cand + m] == sector[i + m]):
+            m += 1
+        emit_sequence(out, sector[anchor:i], i - cand, m)
+        for j in range(i + 1, min(i + m, n - MIN_MATCH + 1)):
+            table[sector[j:j + MIN_MATCH]] = j
+        i += m
+        anchor = i
+    if anchor < n:
+        emit_sequence(out, sector[anchor:], 0, 0)
+    return bytes(out)
+
+
+def compress_image(image, total):
+    zero = bytes(SECTOR_SIZE)
+    index = []
+    data = bytearray()
+    for lba in range(total):
+        sector = image[lba * SECTOR_SIZE:(lba + 1) * SECTOR_SIZE]
+        index.append(len(data))
+        if sector == zero:
+            continue
+        packed = compress_sector(sector)
+        data += packed if len(packed) < SECTOR_SIZE else sector
+    index.append(len(data))
+    return struct.pack("<4sI%dI" % len(index), b"RDSK", total, *index) + bytes(data)
+
+
+def write_c(path, blob, source, total):
+    with open(path, "w") as f:
+        f.write("// Generated by tools/mkromdisk.py from %s. Do not edit.\n" % source)
+        f.write("// %d blocks (%d bytes) compressed to %d bytes.\n\n"
+                % (total, total * SECTOR_SIZE, len(blob)))
+        f.write("#include <stdint.h>\n\n")
+        f.write("const uint8_t romdisk_image[] __attribute__((aligned(4))) =\n{\n")
+        for i in range(0, len(blob), 16):
+            f.write("    " + ", ".join("0x%02x" % b for b in blob[i:i + 16]) + ",\n")
+        f.write("};\n")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Build a compressed FAT image for the ROM disk.")
+    parser.add_argument("--blocks", type=int, default=0,
+                        help="pad the volume out to at least this many 512 byte blocks")
+    parser.add_argument("--label", default="ROMDISK", help="volume label")
+    parser.add_argument("--raw", help="also write the uncompressed volume here")
+    parser.add_argument("source", help="directory whose contents go on the disk")
+    parser.add_argument("output", help="C file to write")
+    args = parser.parse_args()
+
+    if not os.path.isdir(args.source):
+        sys.exit("mkromdisk: %s is not a directory" % args.source)
+
+    image, total = build_image(scan(args.source), args.blocks, args.label)
+    blob = compress_image(image, total)
+    write_c(args.output, blob, args.source, total)
+    if args.raw:
+        with open(args.raw, "wb") as f:
+            f.write(image[:total * SECTOR_SIZE])
+    print("mkromdisk: %d blocks (%d bytes) -> %d bytes" % (total, len(image), len(blob)))
+
+
+if __name__ == "__main__":
+    main()
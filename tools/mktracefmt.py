@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+"""
+Builds the format table that tracedecode.py uses to turn the firmware's binary trace back into
+text. The table is generated from trace_events.h every build so that it always matches the
+firmware it was built with.
+
+Each TRACE_EVENT(name, level, format) line in trace_events.h is one event, numbered from 0 in the
+order they appear. The output is JSON:
+
+    {
+        "events": [
+            { "id": 0, "name": "BOOT", "level": "INFO", "format": "boot", "args": 0,
+              "blob": false },
+            ...
+        ]
+    }
+
+args is the number of {d} / {x} placeholders in the format, i.e. the number of varints that
+follow the timestamp delta in the event's records, and blob says whether a length-prefixed blob
+follows them ({hex} or {str}).
+
+usage: mktracefmt.py TRACE_EVENTS_H OUTPUT.json
+"""
+
+import argparse
+import json
+import re
+import sys
+
+EVENT_RE = re.compile(r'^\s*TRACE_EVENT\(\s*(\w+)\s*,\s*(\w+)\s*,\s*"((?:[^"\\]|\\.)*)"\s*\)',
+                      re.M)
+PLACEHOLDER_RE = re.compile(r"\{(d|x|hex|str)\}")
+BLOBS = ("hex", "str")
+
+
+def parse_events(text):
+    events = []
+    for n, (name, level, fmt) in enumerate(EVENT_RE.findall(text)):
+        kinds = PLACEHOLDER_RE.findall(fmt)
+        if any(k in BLOBS for k in kinds[:-1]):
+            sys.exit("mktracefmt: %s: {hex} or {str} has to be the last placeholder" % name)
+        if n > 0xff:
+            sys.exit("mktracefmt: too many events; IDs are one byte")
+        events.append({
+            "id": n,
+            "name": name,
+            "level": level,
+            "format": fmt,
+            "args": sum(1 for k in kinds if k not in BLOBS),
+            "blob": any(k in BLOBS for k in kinds),
+        })
+    return events
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Build the trace format table.")
+    parser.add_argument("events", help="trace_events.h")
+    parser.add_argument("output", help="JSON file to write")
+    args = parser.parse_args()
+
+    with open(args.events) as f:
+        events = parse_events(f.read())
+    if not events:
+        sys.exit("mktracefmt: no TRACE_EVENT lines in %s" % args.events)
+
+    with open(args.output, "w") as f:
+        json.dump({"events": events}, f, indent=4)
+        f.write("\n")
+    print("mktracefmt: %d events" % len(events))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+"""
+Turns the Micro Trace Buffer captures in a trace (see mtb.h; firmware built with MTB=isr or
+MTB=command) back into source-level branch listings, using the ELF the firmware was built into.
+
+For every capture, each packet becomes one line:
+
+    <source function> <file:line>  ->  <destination function> <file:line>
+
+with "exc" in front of exception entries and returns and "start" in front of the first packet
+after the MTB was started. With --summary only the totals across all captures are printed: how
+many branches landed in each function and on each line, which is where the captured region spent
+its time.
+
+usage: mtbdecode.py [--table build/trace_events.json] [--elf build/build.elf] [--summary]
+                    [CAPTURE]
+"""
+
+import argparse
+import collections
+import struct
+import subprocess
+import sys
+
+import tracedecode
+
+
+class Symbolizer:
+    """
+    Maps code addresses to (function, file:line) with addr2line, asking once per address.
+    """
+
+    def __init__(self, elf, addr2line):
+        self.elf = elf
+        self.addr2line = addr2line
+        self.cache = {}
+
+    def lookup(self, addrs):
+        todo = sorted(set(a for a in addrs if a not in self.cache))
+        for i in range(0, len(todo), 256):
+            chunk = todo[i:i + 256]
+            out = subprocess.run([self.addr2line, "-f", "-e", self.elf] +
+                                 ["%x" % a for a in chunk],
+                                 check=True, capture_output=True, text=True).stdout.splitlines()
+            for n, a in enumerate(chunk):
+                func = out[2 * n]
+                where = out[2 * n + 1].rsplit("/", 1)[-1].split(" ")[0]
+                self.cache[a] = (func, where)
+        return [self.cache[a] for a in addrs]
+
+
+def captures(stream, table):
+    """
+    Yields the packets of each capture as a list of (source, destination) words.
+    """
+    remaining = 0
+    data = b""
+    for event, _, args, blob in tracedecode.read_records(stream, table):
+        if event is None:
+            continue
+        if event["name"] == "MTB_CAPTURE":
+            if data:
+                # the last one was cut short (e.g. records dropped); use what arrived
+                yield list(struct.iter_unpack("<II", data[:len(data) & ~7]))
+            remaining = args[0] * 8
+            data = b""
+            if not remaining:
+                yield []
+        elif event["name"] == "MTB_PACKETS" and remaining:
+            data += blob
+            remaining -= len(blob)
+            if remaining <= 0:
+                yield list(struct.iter_unpack("<II", data[:len(data) & ~7]))
+                data = b""
+                remaining = 0
+    if data:
+        yield list(struct.iter_unpack("<II", data[:len(data) & ~7]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode MTB branch captures from a trace.")
+    parser.add_argument("--table", default="build/trace_events.json",
+                        help="format table generated by the build")
+    parser.add_argument("--elf", default="build/build.elf", help="the firmware's ELF")
+    parser.add_argument("--addr2line", default="arm-none-eabi-addr2line")
+    parser.add_argument("--summary", action="store_true",
+                        help="only print branch counts per function and line")
+    parser.add_argument("capture", nargs="?", help="capture file or serial device (default stdin)")
+    args = parser.parse_args()
+
+    table = tracedecode.Table(args.table)
+    sym = Symbolizer(args.elf, args.addr2line)
+    stream = open(args.capture, "rb") if args.capture else sys.stdin.buffer
+
+    functions = collections.Counter()
+    lines = collections.Counter()
+    try:
+        for n, packets in enumerate(captures(stream, table)):
+            srcs = sym.lookup([s & ~1 for s, _ in packets])
+            dsts = sym.lookup([d & ~1 for _, d in packets])
+            if not args.summary:
+                print("capture %d, %d packets" % (n, len(packets)))
+            for (s, d), (sf, sl), (df, dl) in zip(packets, srcs, dsts):
+                functions[df] += 1
+                lines[dl] += 1
+                if not args.summary:
+                    flag = "exc" if s & 1 else ("start" if d & 1 else "")
+                    print("  %-5s %s %s  ->  %s %s" % (flag, sf, sl, df, dl))
+    except tracedecode.TraceError as e:
+        sys.exit("mtbdecode: %s" % e)
+    except subprocess.CalledProcessError as e:
+        sys.exit("mtbdecode: %s failed: %s" % (args.addr2line, e.stderr.strip()))
+    except KeyboardInterrupt:
+        pass
+
+    if args.summary:
+        total = sum(functions.values()) or 1
+        print("branches into each function:")
+        for func, count in functions.most_common():
+            print("  %6d  %5.1f%%  %s" % (count, 100.0 * count / total, func))
+        print("branches onto each line:")
+        for where, count in lines.most_common(40):
+            print("  %6d  %s" % (count, where))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,75 @@
+"""
+Just enough of Linux's SG_IO to send the firmware's vendor-specific SCSI commands from Python,
+without sg3_utils. Open the device's /dev/sg* or /dev/sd* node (root or the disk group is usually
+needed) and pass the file descriptor in.
+"""
+
+import ctypes
+import fcntl
+
+SG_IO = 0x2285
+SG_DXFER_NONE = -1
+SG_DXFER_FROM_DEV = -3
+SENSE_LEN = 32
+
+
+class SgIoHdr(ctypes.Structure):
+    _fields_ = [
+        ("interface_id", ctypes.c_int),
+        ("dxfer_direction", ctypes.c_int),
+        ("cmd_len", ctypes.c_ubyte),
+        ("mx_sb_len", ctypes.c_ubyte),
+        ("iovec_count", ctypes.c_ushort),
+        ("dxfer_len", ctypes.c_uint),
+        ("dxferp", ctypes.c_void_p),
+        ("cmdp", ctypes.c_void_p),
+        ("sbp", ctypes.c_void_p),
+        ("timeout", ctypes.c_uint),
+        ("flags", ctypes.c_uint),
+        ("pack_id", ctypes.c_int),
+        ("usr_ptr", ctypes.c_void_p),
+        ("status", ctypes.c_ubyte),
+        ("masked_status", ctypes.c_ubyte),
+        ("msg_status", ctypes.c_ubyte),
+        ("sb_len_wr", ctypes.c_ubyte),
+        ("host_status", ctypes.c_ushort),
+        ("driver_status", ctypes.c_ushort),
+        ("resid", ctypes.c_int),
+        ("duration", ctypes.c_uint),
+        ("info", ctypes.c_uint),
+    ]
+
+
+class ScsiError(Exception):
+    pass
+
+
+def command(fd, cdb, length=0, timeout_ms=5000):
+    """
+    Sends cdb and returns the data the device sent back (up to length bytes; length 0 means no
+    data stage). Raises ScsiError with the sense key / ASC / ASCQ if the command fails.
+    """
+    cdb_buf = ctypes.create_string_buffer(bytes(cdb), len(cdb))
+    data_buf = ctypes.create_string_buffer(max(length, 1))
+    sense_buf = ctypes.create_string_buffer(SENSE_LEN)
+
+    hdr = SgIoHdr()
+    hdr.interface_id = ord("S")
+    hdr.dxfer_direction = SG_DXFER_FROM_DEV if length else SG_DXFER_NONE
+    hdr.cmd_len = len(cdb)
+    hdr.mx_sb_len = SENSE_LEN
+    hdr.dxfer_len = length
+    hdr.dxferp = ctypes.cast(data_buf, ctypes.c_void_p)
+    hdr.cmdp = ctypes.cast(cdb_buf, ctypes.c_void_p)
+    hdr.sbp = ctypes.cast(sense_buf, ctypes.c_void_p)
+    hdr.timeout = timeout_ms
+
+    fcntl.ioctl(fd, SG_IO, hdr)
+    if hdr.status or hdr.host_status or hdr.driver_status:
+        sense = sense_buf.raw[:hdr.sb_len_wr]
+        if len(sense) >= 14:
+            raise ScsiError("check condition: key %x asc %02x ascq %02x" %
+                            (sense[2] & 0x0f, sense[12], sense[13]))
+        raise ScsiError("status %02x host %04x driver %04x" %
+                        (hdr.status, hdr.host_status, hdr.driver_status))
+    return data_buf.raw[:length - hdr.resid]
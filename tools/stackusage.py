@@ -0,0 +1,197 @@
+#!/usr/bin/env python3
+"""
+Works out the most stack the firmware can need, from the per-function frame sizes gcc writes with
+-fstack-usage (the .su files next to the objects) and the call graph in the linked ELF's
+disassembly, and checks it against the STACK_SIZE the firmware was linked with.
+
+The worst case is the deepest call chain from Reset_Handler (which calls main), plus the deepest
+one from any interrupt handler, plus the frame the core pushes on exception entry. Only one
+handler is counted: USB_Handler and DMAC_Handler run at the same priority, so they never preempt
+each other. Calls through function pointers (the block device hooks, mostly) can't be followed in
+the disassembly, so an indirect call is charged as the deepest function that's never called
+directly. Functions without a .su entry (libgcc, newlib) are charged --unknown bytes each.
+Recursion makes the worst case unbounded, and is reported as an error.
+
+Prints the worst chain and how much of the stack is spare. If STACK_SIZE minus --margin can't
+hold the worst case it exits with an error, and nothing is written to --output, so make tries
+again next time. Spare bytes are reported as the number of 512 byte RAM disk blocks they'd pay
+for if STACK_SIZE came down.
+
+usage: stackusage.py --stack-size SIZE [--margin BYTES] [--unknown BYTES] [--objdump OBJDUMP]
+                     [--output REPORT] ELF SU_DIR
+"""
+
+import argparse
+import glob
+import os
+import re
+import subprocess
+import sys
+
+# r0-r3, r12, lr, pc and xPSR, plus a word of padding when the stack isn't 8 byte aligned
+EXCEPTION_FRAME = 36
+BLOCK_SIZE = 512
+
+FUNCTION = re.compile(r"^[0-9a-f]+ <([^>]+)>:$")
+CALL = re.compile(r"\s(bl|b|b\.n)\s+[0-9a-f]+ <([^>+]+)>$")
+INDIRECT_CALL = re.compile(r"\sblx\s+r\d+$")
+
+
+class StackError(Exception):
+    pass
+
+
+def read_frames(su_dir):
+    """
+    Returns {function: frame bytes} from every .su file under su_dir. Static functions with the
+    same name in different files are charged the bigger of their frames.
+    """
+    frames = {}
+    dynamic = []
+    for path in glob.glob(os.path.join(su_dir, "*.su")):
+        with open(path) as f:
+            for line in f:
+                where, size, kind = line.rstrip("\n").split("\t")
+                name = where.rsplit(":", 1)[-1]
+                frames[name] = max(frames.get(name, 0), int(size))
+                if kind == "dynamic":
+                    dynamic.append(name)
+    return frames, dynamic
+
+
+def read_calls(elf, objdump):
+    """
+    Returns ({function: set of functions it calls directly}, set of functions that make calls
+    through a pointer).
+    """
+    out = subprocess.run([objdump, "-d", elf], check=True, capture_output=True,
+                         text=True).stdout
+    calls = {}
+    indirect = set()
+    current = None
+    for line in out.splitlines():
+        m = FUNCTION.match(line)
+        if m:
+            current = m.group(1)
+            calls.setdefault(current, set())
+            continue
+        if current is None:
+            continue
+        m = CALL.search(line)
+        if m and m.group(2) != current:
+            # a branch to another function's entry is a tail call; it still needs the stack
+            calls[current].add(m.group(2))
+        elif INDIRECT_CALL.search(line):
+            indirect.add(current)
+    return calls, indirect
+
+
+class CallGraph:
+    def __init__(self, frames, calls, indirect, unknown):
+        self.frames = frames
+        self.calls = calls
+        self.indirect = indirect
+        self.unknown = unknown
+        self.missing = set()
+        self.memo = {}
+        called = set().union(*calls.values()) if calls else set()
+        self.pointer_targets = [f for f in calls if f not in called and
+                                not f.endswith("_Handler") and f != "main"]
+        self.pointer_worst = None
+
+    def frame(self, func):
+        if func not in self.frames:
+            self.missing.add(func)
+            return self.unknown
+        return self.frames[func]
+
+    def worst(self, func, path=()):
+        """
+        Returns (bytes, chain) for the deepest call chain starting at func.
+        """
+        if func in path:
+            raise StackError("recursion: " + " -> ".join(path + (func,)))
+        if func in self.memo:
+            return self.memo[func]
+        path = path + (func,)
+        deepest = (0, [])
+        for callee in sorted(self.calls.get(func, ())):
+            deepest = max(deepest, self.worst(callee, path), key=lambda w: w[0])
+        if func in self.indirect:
+            deepest = max(deepest, self.worst_pointer_target(path), key=lambda w: w[0])
+        result = (self.frame(func) + deepest[0], [func] + deepest[1])
+        self.memo[func] = result
+        return result
+
+    def worst_pointer_target(self, path):
+        if self.pointer_worst is None:
+            self.pointer_worst = (0, [])
+            for func in self.pointer_targets:
+                if func not in path:
+                    depth, chain = self.worst(func, path)
+                    if depth > self.pointer_worst[0]:
+                        self.pointer_worst = (depth, ["(indirect)"] + chain)
+        return self.pointer_worst
+
+
+def estimate(frames, calls, indirect, unknown):
+    graph = CallGraph(frames, calls, indirect, unknown)
+    thread = graph.worst("Reset_Handler")
+    handlers = [graph.worst(f) for f in sorted(calls)
+                if f.endswith("_Handler") and f != "Reset_Handler"]
+    isr = max(handlers, key=lambda w: w[0], default=(0, []))
+    return thread, isr, graph.missing
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0].strip())
+    parser.add_argument("--stack-size", required=True, type=lambda s: int(s, 0),
+                        help="STACK_SIZE the firmware was linked with")
+    parser.add_argument("--margin", type=lambda s: int(s, 0), default=256,
+                        help="bytes to keep spare on top of the estimate")
+    parser.add_argument("--unknown", type=int, default=32,
+                        help="bytes to charge a function with no .su entry")
+    parser.add_argument("--objdump", default="arm-none-eabi-objdump")
+    parser.add_argument("--output", help="write the report here as well")
+    parser.add_argument("elf")
+    parser.add_argument("su_dir")
+    args = parser.parse_args()
+
+    frames, dynamic = read_frames(args.su_dir)
+    if not frames:
+        sys.exit("%s: no .su files (was it built with -fstack-usage?)" % args.su_dir)
+    calls, indirect = read_calls(args.elf, args.objdump)
+    try:
+        thread, isr, missing = estimate(frames, calls, indirect, args.unknown)
+    except StackError as e:
+        sys.exit("stackusage: %s" % e)
+
+    total = thread[0] + isr[0] + EXCEPTION_FRAME
+    needed = total + args.margin
+    lines = [
+        "thread %5d  %s" % (thread[0], " -> ".join(thread[1])),
+        "isr    %5d  %s" % (isr[0], " -> ".join(isr[1])),
+        "frame  %5d" % EXCEPTION_FRAME,
+        "worst  %5d  (+%d margin = %d of %d)" % (total, args.margin, needed, args.stack_size),
+    ]
+    if dynamic:
+        lines.append("dynamic frames (not bounded): " + ", ".join(sorted(set(dynamic))))
+    if missing:
+        lines.append("no stack usage, charged %d each: %s" % (args.unknown,
+                                                             ", ".join(sorted(missing))))
+    if needed > args.stack_size:
+        print("\n".join(lines), file=sys.stderr)
+        sys.exit("stackusage: STACK_SIZE 0x%x is %d bytes short" % (args.stack_size,
+                                                                   needed - args.stack_size))
+    spare = args.stack_size - needed
+    lines.append("spare  %5d  (STACK_SIZE could be 0x%x, giving RAMDISK_BLOCKS %d more)" %
+                 (spare, (needed + 7) & ~7, spare // BLOCK_SIZE))
+    report = "\n".join(lines) + "\n"
+    sys.stdout.write(report)
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(report)
+
+
+if __name__ == "__main__":
+    main()
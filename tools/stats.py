@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+"""
+Reads the firmware's counters with the vendor-specific SCSI command 0xc2 and prints them (see
+stats.h for the report layout). With --interval it keeps polling and prints how much each counter
+moved since the last poll instead, which is handy for watching throughput on a live device.
+
+Counters are only ever appended to the report, so this reads any report version at least as new
+as the fields below; anything newer it doesn't know about is skipped.
+
+usage: stats.py [--interval SECONDS] DEVICE
+"""
+
+import argparse
+import os
+import struct
+import sys
+import time
+
+import sgio
+
+OPCODE = 0xc2
+HEADER = struct.Struct("<BBHHH")
+
+# (name, struct format, version the counter first appeared in), in report order
+COUNTERS = [
+    ("bytes_read", "Q", 1),
+    ("bytes_written", "Q", 1),
+    ("usb_interrupts", "I", 1),
+    ("dmac_interrupts", "I", 1),
+    ("usb_resets", "I", 1),
+    ("stalls", "I", 1),
+    ("overlay_hits", "I", 1),
+    ("overlay_misses", "I", 1),
+    ("flash_erases", "I", 1),
+    ("trace_dropped", "I", 2),
+    ("stack_size", "I", 3),
+    ("stack_high_water", "I", 3),
+]
+
+
+def parse(report):
+    """
+    Returns a dict of counter name to value, with per-opcode command counts as "cmd_XX".
+    """
+    version, slots, length, opcodes_offset, _ = HEADER.unpack_from(report)
+    if len(report) < length:
+        raise ValueError("short report: %d of %d bytes" % (len(report), length))
+
+    values = {"version": version}
+    pos = HEADER.size
+    for name, fmt, since in COUNTERS:
+        if since > version:
+            break
+        pos = (pos + struct.calcsize(fmt) - 1) & ~(struct.calcsize(fmt) - 1)
+        (values[name],) = struct.unpack_from("<" + fmt, report, pos)
+        pos += struct.calcsize(fmt)
+
+    opcodes = report[opcodes_offset:opcodes_offset + slots]
+    commands_offset = (opcodes_offset + slots + 3) & ~3
+    counts = struct.unpack_from("<%dI" % slots, report, commands_offset)
+    for slot, (op, count) in enumerate(zip(opcodes, counts)):
+        values["cmd_other" if slot == 0 else "cmd_%02x" % op] = count
+    return values
+
+
+def read_stats(fd):
+    return parse(sgio.command(fd, bytes([OPCODE, 0, 0, 0, 0, 0, 0, 0, 0, 0]), 512))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Read the firmware's counters.")
+    parser.add_argument("--interval", type=float, help="poll every this many seconds")
+    parser.add_argument("device", help="the drive's /dev/sg* or /dev/sd* node")
+    args = parser.parse_args()
+
+    fd = os.open(args.device, os.O_RDONLY)
+    try:
+        last = read_stats(fd)
+        for name, value in last.items():
+            print("%-20s %d" % (name, value))
+
+        while args.interval:
+            time.sleep(args.interval)
+            now = read_stats(fd)
+            moved = ["%s +%d" % (k, v - last.get(k, 0)) for k, v in now.items()
+                     if k != "version" and v != last.get(k, 0)]
+            print("%s  %s" % (time.strftime("%H:%M:%S"), ", ".join(moved) or "idle"), flush=True)
+            last = now
+    except sgio.ScsiError as e:
+        sys.exit("stats: %s" % e)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        os.close(fd)
+
+
+if __name__ == "__main__":
+    main()
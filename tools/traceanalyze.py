@@ -0,0 +1,319 @@
+#!/usr/bin/env python3
+"""
+Rebuilds the mass storage transactions in a firmware trace (see trace.h) and summarizes them. Each
+CBW, the data packets that follow it and the CSW that ends it become one command, with the time
+from the CBW to the first data packet (setup), across the data packets (data) and from the last
+one to the CSW (status).
+
+Anything out of the ordinary is printed as it turns up, prefixed with "!":
+    - STALLs on EP0 and EP1
+    - USB resets and reboots
+    - a tag the host has used in the last --recent commands (the host retrying a command)
+    - a CBW while the previous command is still waiting for its CSW
+    - a CSW that doesn't match the command it ends, or a phase error
+    - records the firmware dropped, and records the format table doesn't know
+
+At the end come per-opcode counts, bytes moved, latency percentiles and throughput: over the
+whole capture (wall) and over the time a command was outstanding (busy). With --timeline every
+command is printed as well.
+
+The CBW and packet records are DEBUG, so the firmware has to be tracing at that level, which it
+does from boot. Commands that were open when records were dropped are marked "dropped" and left
+out of the latency figures, since some of their timeline is missing.
+
+The capture is read as a stream and nothing is kept per command once it's finished, so memory
+stays flat however big the capture is; latency percentiles come from histograms with eight
+buckets per power of two, so they're good to about 9%. Reading a serial device directly works
+too, and Ctrl-C prints the summary so far.
+
+usage: traceanalyze.py [--table build/trace_events.json] [--clock HZ] [--timeline]
+                       [--recent N] [CAPTURE]
+"""
+
+import argparse
+import collections
+import math
+import struct
+import sys
+
+import tracedecode
+
+OPCODES = {
+    0x00: "TEST UNIT READY",
+    0x03: "REQUEST SENSE",
+    0x12: "INQUIRY",
+    0x1a: "MODE SENSE(6)",
+    0x1b: "START STOP UNIT",
+    0x1e: "PREVENT ALLOW REMOVAL",
+    0x23: "READ FORMAT CAPACITIES",
+    0x25: "READ CAPACITY(10)",
+    0x28: "READ(10)",
+    0x2a: "WRITE(10)",
+    0x2f: "VERIFY(10)",
+    0x35: "SYNCHRONIZE CACHE(10)",
+    0x41: "WRITE SAME(10)",
+    0x42: "UNMAP",
+    0x5a: "MODE SENSE(10)",
+    0x88: "READ(16)",
+    0x8a: "WRITE(16)",
+    0x93: "WRITE SAME(16)",
+    0x9e: "SERVICE ACTION IN(16)",
+    0xc0: "VENDOR REVERT",
+    0xc1: "VENDOR LATENCY",
+    0xc2: "VENDOR STATS",
+}
+
+CSW = struct.Struct("<4sIIB")
+CSW_STATUS = {0: "passed", 1: "failed", 2: "phase error"}
+
+
+def opcode_name(opcode):
+    return OPCODES.get(opcode, "opcode 0x%02x" % opcode)
+
+
+class Histogram:
+    """
+    Log-scale histogram of positive values, eight buckets per power of two.
+    """
+
+    STEPS = 8
+
+    def __init__(self):
+        self.buckets = collections.Counter()
+        self.count = 0
+        self.max = 0
+
+    def add(self, value):
+        self.buckets[int(math.log2(value) * self.STEPS) if value >= 1 else -1] += 1
+        self.count += 1
+        self.max = max(self.max, value)
+
+    def percentile(self, p):
+        """
+        Returns the upper edge of the bucket the p'th percentile falls in.
+        """
+        rank = math.ceil(self.count * p / 100)
+        seen = 0
+        for bucket in sorted(self.buckets):
+            seen += self.buckets[bucket]
+            if seen >= rank:
+                return min(2 ** ((bucket + 1) / self.STEPS), self.max)
+        return self.max
+
+
+class Command:
+    __slots__ = ("tag", "opcode", "lun", "length", "start", "first_data", "last_data",
+                 "data_bytes", "stalled", "dropped")
+
+    def __init__(self, t, tag, length, lun, opcode):
+        self.tag = tag
+        self.opcode = opcode
+        self.lun = lun
+        self.length = length
+        self.start = t
+        self.first_data = None
+        self.last_data = None
+        self.data_bytes = 0
+        self.stalled = False
+        self.dropped = False
+
+    def data(self, t, n):
+        if self.first_data is None:
+            self.first_data = t
+        self.last_data = t
+        self.data_bytes += n
+
+
+class OpcodeStats:
+    __slots__ = ("count", "failed", "incomplete", "bytes", "latency")
+
+    def __init__(self):
+        self.count = 0
+        self.failed = 0
+        self.incomplete = 0
+        self.bytes = 0
+        self.latency = Histogram()
+
+
+class Analyzer:
+    def __init__(self, clock, timeline, recent, out=sys.stdout):
+        self.clock = clock
+        self.timeline = timeline
+        self.out = out
+        self.recent = collections.deque(maxlen=recent)
+        self.command = None
+        self.pending_out = None
+        self.opcodes = collections.defaultdict(OpcodeStats)
+        self.anomalies = collections.Counter()
+        self.first = None
+        self.last = 0
+        self.busy = 0
+        self.bytes_in = 0
+        self.bytes_out = 0
+
+    def us(self, cycles):
+        return cycles * 1e6 / self.clock
+
+    def flag(self, t, kind, text):
+        self.anomalies[kind] += 1
+        print("%12.1f  ! %s" % (self.us(t), text), file=self.out, flush=True)
+
+    def feed(self, t, event, args, blob):
+        """
+        Takes one record at cycle time t.
+        """
+        if event is None:
+            self.flag(t, "unknown event", "unknown event %d" % args[0])
+            return
+        name = event["name"]
+
+        # An EP2 packet is either the CBW, which is traced straight after it, or OUT data.
+        if self.pending_out is not None and name != "CBW":
+            if self.command is not None:
+                self.command.data(*self.pending_out)
+                self.bytes_out += self.pending_out[1]
+        self.pending_out = None
+
+        if name == "EP2_OUT":
+            self.pending_out = (t, args[0])
+        elif name == "CBW":
+            self.cbw(t, *args, blob)
+        elif name == "EP1_IN":
+            self.ep1_in(t, args[0], blob)
+        elif name == "EP1_STALL":
+            what = " on %s tag %08x" % (opcode_name(self.command.opcode), self.command.tag) \
+                if self.command is not None else ""
+            if self.command is not None:
+                self.command.stalled = True
+            self.flag(t, "EP1 STALL", "EP1 STALL" + what)
+        elif name == "EP0_STALL":
+            self.flag(t, "EP0 STALL", "EP0 STALL")
+        elif name in ("USB_RESET", "BOOT"):
+            self.abort(t, "USB reset" if name == "USB_RESET" else "reboot")
+            self.flag(t, name, "USB reset" if name == "USB_RESET" else "device booted")
+            self.recent.clear()
+        elif name == "DROPPED":
+            if self.command is not None:
+                self.command.dropped = True
+            self.flag(t, "dropped", "%d records dropped" % args[0])
+
+    def cbw(self, t, tag, length, flags, lun, cb):
+        if self.command is not None:
+            self.flag(t, "no CSW", "tag %08x (%s) never got a CSW" %
+                      (self.command.tag, opcode_name(self.command.opcode)))
+            self.abort(t, "no CSW")
+        if tag in self.recent:
+            self.flag(t, "retransmitted tag", "tag %08x reused" % tag)
+        self.recent.append(tag)
+        if self.first is None:
+            self.first = t
+        self.command = Command(t, tag, length, lun, cb[0] if cb else 0xff)
+
+    def ep1_in(self, t, n, blob):
+        if n == CSW.size and len(blob) >= CSW.size and blob.startswith(b"USBS"):
+            _, tag, residue, status = CSW.unpack_from(blob)
+            if self.command is None or self.command.tag != tag:
+                self.flag(t, "stray CSW", "CSW for tag %08x with no command open" % tag)
+                return
+            if status == 2:
+                self.flag(t, "phase error", "tag %08x (%s) phase error" %
+                          (tag, opcode_name(self.command.opcode)))
+            self.finish(t, CSW_STATUS.get(status, "status %d" % status))
+        elif self.command is not None:
+            self.command.data(t, n)
+            self.bytes_in += n
+
+    def abort(self, t, why):
+        if self.command is not None:
+            self.opcodes[self.command.opcode].incomplete += 1
+            if self.timeline:
+                self.print_command(self.command, None, why)
+            self.command = None
+
+    def finish(self, t, status):
+        c = self.command
+        self.command = None
+        stats = self.opcodes[c.opcode]
+        stats.count += 1
+        stats.bytes += c.data_bytes
+        if status != "passed":
+            stats.failed += 1
+        if not c.dropped:
+            stats.latency.add(t - c.start)
+        self.busy += t - c.start
+        self.last = t
+        if self.timeline:
+            self.print_command(c, t, status)
+
+    def print_command(self, c, end, status):
+        notes = [status] + [n for n, on in (("stalled", c.stalled), ("dropped", c.dropped)) if on]
+        if end is None or c.first_data is None:
+            phases = "%28s" % ""
+        else:
+            phases = "%8.1f %8.1f %8.1f  " % (self.us(c.first_data - c.start),
+                                             self.us(c.last_data - c.first_data),
+                                             self.us(end - c.last_data))
+        total = "%9.1f" % self.us(end - c.start) if end is not None else "%9s" % "-"
+        print("%12.1f  %08x  %-22s  lun %d  %7d/%-7d  %s%s us  %s" %
+              (self.us(c.start), c.tag, opcode_name(c.opcode), c.lun, c.data_bytes, c.length,
+               phases, total, ", ".join(notes)), file=self.out, flush=True)
+
+    def summary(self):
+        out = self.out
+        print(file=out)
+        print("%-22s %8s %6s %6s %12s %9s %9s %9s %9s" %
+              ("command", "count", "failed", "open", "bytes", "p50 us", "p90 us", "p99 us",
+               "max us"), file=out)
+        for opcode in sorted(self.opcodes):
+            s = self.opcodes[opcode]
+            h = s.latency
+            lat = ["%9.1f" % self.us(h.percentile(p)) if h.count else "%9s" % "-"
+                   for p in (50, 90, 99)]
+            lat.append("%9.1f" % self.us(h.max) if h.count else "%9s" % "-")
+            print("%-22s %8d %6d %6d %12d %s" % (opcode_name(opcode), s.count, s.failed,
+                                                 s.incomplete, s.bytes, " ".join(lat)), file=out)
+
+        wall = self.us(self.last - self.first) if self.first is not None else 0
+        busy = self.us(self.busy)
+        print(file=out)
+        for label, n in (("read (IN)", self.bytes_in), ("written (OUT)", self.bytes_out)):
+            print("%-14s %12d bytes  %8.1f kB/s wall  %8.1f kB/s busy" %
+                  (label, n, n / wall * 1e3 if wall else 0, n / busy * 1e3 if busy else 0),
+                  file=out)
+        print("%-14s %12.1f us wall  %12.1f us busy" % ("time", wall, busy), file=out)
+        if self.anomalies:
+            print(file=out)
+            for kind, n in sorted(self.anomalies.items()):
+                print("%-20s %8d" % (kind, n), file=out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Rebuild and summarize the mass storage "
+                                     "transactions in the firmware's trace.")
+    parser.add_argument("--table", default="build/trace_events.json",
+                        help="format table generated by the build")
+    parser.add_argument("--clock", type=float, default=48e6, help="timestamp clock in Hz")
+    parser.add_argument("--timeline", action="store_true", help="print every command")
+    parser.add_argument("--recent", type=int, default=16,
+                        help="how many commands back a reused tag counts as a retry")
+    parser.add_argument("capture", nargs="?", help="capture file or serial device (default stdin)")
+    args = parser.parse_args()
+
+    table = tracedecode.Table(args.table)
+    stream = open(args.capture, "rb") if args.capture else sys.stdin.buffer
+    analyzer = Analyzer(args.clock, args.timeline, args.recent)
+
+    cycles = 0
+    try:
+        for event, delta, values, blob in tracedecode.read_records(stream, table):
+            cycles += delta
+            analyzer.feed(cycles, event, values, blob)
+    except tracedecode.TraceError as e:
+        print("traceanalyze: %s" % e, file=sys.stderr)
+    except KeyboardInterrupt:
+        pass
+    analyzer.summary()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+"""
+Decodes the firmware's binary trace (see trace.h) back into text, one line per record:
+
+    <time in microseconds since tracing started>  <event text>
+
+The input is a raw capture of the UART, either a file or the serial device itself, and is read
+as a stream, so it can be left running against the port. The format table comes from the build
+(build/trace_events.json, written by mktracefmt.py) and has to match the firmware that produced
+the trace.
+
+Timestamp deltas are core clock cycles from the firmware's TC4/TC5 timestamp counter, which wraps
+every 2^32 cycles (about 89 s at 48 MHz); a longer gap between two records comes out short.
+
+usage: tracedecode.py [--table build/trace_events.json] [--clock HZ] [CAPTURE]
+"""
+
+import argparse
+import json
+import re
+import sys
+
+PLACEHOLDER_RE = re.compile(r"\{(d|x|hex|str)\}")
+
+
+class Table:
+    def __init__(self, path):
+        with open(path) as f:
+            self.events = {e["id"]: e for e in json.load(f)["events"]}
+
+
+class TraceError(Exception):
+    pass
+
+
+def read_varint(rec, pos):
+    value = 0
+    shift = 0
+    while True:
+        if pos >= len(rec):
+            raise TraceError("varint runs off the end of the record")
+        b = rec[pos]
+        pos += 1
+        value |= (b & 0x7f) << shift
+        shift += 7
+        if not b & 0x80:
+            return value, pos
+
+
+def read_records(stream, table):
+    """
+    Yields (event, delta, args, blob) for each record in stream, where event is the table entry.
+    Records with an ID the table doesn't know are yielded with event None so that the caller can
+    at least count them; their length byte still lets the stream stay in step.
+    """
+    while True:
+        head = stream.read(1)
+        if not head:
+            return
+        rec = stream.read(head[0])
+        if len(rec) < head[0]:
+            return
+        if not rec:
+            raise TraceError("empty record")
+
+        event = table.events.get(rec[0])
+        delta, pos = read_varint(rec, 1)
+        if event is None:
+            yield None, delta, [rec[0]], b""
+            continue
+
+        args = []
+        for _ in range(event["args"]):
+            value, pos = read_varint(rec, pos)
+            args.append(value)
+        blob = b""
+        if event["blob"]:
+            n, pos = read_varint(rec, pos)
+            blob = rec[pos:pos + n]
+        yield event, delta, args, blob
+
+
+def format_record(event, args, blob):
+    if event is None:
+        return "unknown event %d" % args[0]
+    values = iter(args)
+
+    def sub(m):
+        if m.group(1) == "hex":
+            return " ".join("%02x" % b for b in blob)
+        if m.group(1) == "str":
+            return blob.decode("ascii", "backslashreplace")
+        value = next(values)
+        return ("%d" if m.group(1) == "d" else "%x") % value
+
+    return PLACEHOLDER_RE.sub(sub, event["format"])
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode the firmware's binary trace.")
+    parser.add_argument("--table", default="build/trace_events.json",
+                        help="format table generated by the build")
+    parser.add_argument("--clock", type=float, default=48e6, help="timestamp clock in Hz")
+    parser.add_argument("capture", nargs="?", help="capture file or serial device (default stdin)")
+    args = parser.parse_args()
+
+    table = Table(args.table)
+    stream = open(args.capture, "rb") if args.capture else sys.stdin.buffer
+
+    cycles = 0
+    try:
+        for event, delta, values, blob in read_records(stream, table):
+            cycles += delta
+            print("%12.1f  %s" % (cycles * 1e6 / args.clock, format_record(event, values, blob)),
+                  flush=True)
+    except TraceError as e:
+        sys.exit("tracedecode: %s" % e)
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,142 @@
+#include "trace.h"
+
+#include "stats.h"
+#include "timestamp.h"
+
+#include <string.h>
+
+// length, event, a 32 bit delta, the arguments, the blob length and the blob
+#define TRACE_RECORD_MAX (2 + 5 + (5 * TRACE_ARGS_MAX) + 1 + TRACE_BLOB_MAX)
+
+// a DROPPED record: length, event, delta and the count
+#define TRACE_DROPPED_MAX (2 + 5 + 5)
+
+#define TRACE_EVENT(name, level, format) TRACE_LEVEL_##level,
+static const uint8_t trace_event_levels[TRACE_EVENT_COUNT] =
+{
+#include "trace_events.h"
+};
+#undef TRACE_EVENT
+
+static ring_buffer_t *trace_ring;
+static void (*trace_kick)(void);
+static uint8_t trace_level;
+
+// timestamp of the last record that made it into the ring
+static uint32_t trace_last;
+
+// records turned away since the last DROPPED record went out
+static uint32_t trace_dropped;
+
+void trace_init(ring_buffer_t *rb, void (*kick)(void))
+{
+    trace_ring = rb;
+    trace_kick = kick;
+    trace_level = TRACE_LEVEL_DEBUG;
+    trace_last = timestamp_now();
+    trace_dropped = 0;
+}
+
+void trace_set_level(uint8_t level)
+{
+    trace_level = level;
+}
+
+uint8_t trace_get_level(void)
+{
+    return trace_level;
+}
+
+static uint8_t *trace_put_varint(uint8_t *p, uint32_t v)
+{
+    for (; v >= 0x80; v >>= 7) {
+        *p++ = (uint8_t)(v | 0x80);
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+/**
+ * Builds a record in rec and returns its length.
+ */
+static uint32_t trace_encode(uint8_t *rec, trace_event_t event, uint32_t delta,
+                             const uint32_t *args, uint32_t nargs,
+                             const void *blob, uint32_t blob_len)
+{
+    uint8_t *p = &rec[1];
+
+    *p++ = (uint8_t)event;
+    p = trace_put_varint(p, delta);
+
+    if (nargs > TRACE_ARGS_MAX) {
+        nargs = TRACE_ARGS_MAX;
+    }
+    for (uint32_t i = 0; i < nargs; i++) {
+        p = trace_put_varint(p, args[i]);
+    }
+
+    if (blob) {
+        if (blob_len > TRACE_BLOB_MAX) {
+            blob_len = TRACE_BLOB_MAX;
+        }
+        p = trace_put_varint(p, blob_len);
+        memcpy(p, blob, blob_len);
+        p += blob_len;
+    }
+
+    rec[0] = (uint8_t)(p - &rec[1]);
+    return p - rec;
+}
+
+/**
+ * Whether len more bytes of records at level fit in the ring without cutting into the space kept
+ * back for more important ones.
+ */
+static int trace_fits(uint8_t level, uint32_t len)
+{
+    const uint32_t size = trace_ring->mask + 1;
+    uint32_t reserve = 0;
+    if (level == TRACE_LEVEL_DEBUG) {
+        reserve = size >> 2;
+    } else if (level == TRACE_LEVEL_INFO) {
+        reserve = size >> 3;
+    }
+    return ring_buffer_free(trace_ring) >= (len + reserve);
+}
+
+void trace_record(trace_event_t event, const uint32_t *args, uint32_t nargs,
+                  const void *blob, uint32_t blob_len)
+{
+    const uint8_t level = trace_event_levels[event];
+    if (level < trace_level) {
+        return;
+    }
+
+    const uint32_t now = timestamp_now();
+    uint8_t dropped[TRACE_DROPPED_MAX];
+    uint32_t dropped_len = 0;
+    uint8_t rec[TRACE_RECORD_MAX];
+    uint32_t len;
+
+    // Owe the host a DROPPED record? It goes first and takes the time delta, and the two only go
+    // in together, so the count can't get lost.
+    if (trace_dropped) {
+        dropped_len = trace_encode(dropped, TRACE_DROPPED, now - trace_last, &trace_dropped, 1,
+                                   0, 0);
+        len = trace_encode(rec, event, 0, args, nargs, blob, blob_len);
+    } else {
+        len = trace_encode(rec, event, now - trace_last, args, nargs, blob, blob_len);
+    }
+
+    if (!trace_fits(level, dropped_len + len)) {
+        trace_dropped++;
+        stats.trace_dropped++;
+        return;
+    }
+
+    ring_buffer_write(trace_ring, dropped, dropped_len);
+    ring_buffer_write(trace_ring, rec, len);
+    trace_last = now;
+    trace_dropped = 0;
+    trace_kick();
+}
@@ -0,0 +1,82 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#include "ring_buffer.h"
+
+/**
+ * Binary event trace. Instead of formatting text on the device, each event goes into the log
+ * ring as a record of raw values, and tools/tracedecode.py turns the records back into text on
+ * the host using the format table that the build generates from trace_events.h.
+ *
+ * A record is
+ *
+ *     uint8_t length      of everything after this byte
+ *     uint8_t event       a trace_event_t
+ *     varint  delta       timestamp cycles (see timestamp.h) since the previous record
+ *     varint  args[]      the event's scalar arguments
+ *     varint  blob_len    }
+ *     uint8_t blob[]      } only if the event's format has a {hex} or {str}
+ *
+ * where a varint is LEB128: 7 bits at a time, least significant first, with the top bit set on
+ * every byte but the last. A CBW comes out at about 30 bytes instead of over 100 as text.
+ *
+ * Records go to the ring exactly like text used to, so the same single-producer rules apply.
+ *
+ * A record either goes into the ring whole or not at all; nothing waits for space. Each event has
+ * a level, and the lower levels can only use part of the ring (DEBUG three quarters, INFO seven
+ * eighths), so a flood of debug records can't crowd out the errors. Records that don't fit are
+ * counted, and the count goes out as a DROPPED record in front of the next one that does.
+ * Records below the level set with trace_set_level are filtered out without being counted.
+ */
+#define TRACE_LEVEL_DEBUG 0
+#define TRACE_LEVEL_INFO 1
+#define TRACE_LEVEL_ERROR 2
+
+#define TRACE_EVENT(name, level, format) TRACE_##name,
+typedef enum trace_event
+{
+#include "trace_events.h"
+    TRACE_EVENT_COUNT
+} trace_event_t;
+#undef TRACE_EVENT
+
+#define TRACE_ARGS_MAX 8
+#define TRACE_BLOB_MAX 64
+
+/**
+ * Records are written to rb, and kick is called after each one so that whatever drains rb can get
+ * going. timestamp_init() has to have run first.
+ */
+void trace_init(ring_buffer_t *rb, void (*kick)(void));
+
+/**
+ * Only events at level and above are traced. Everything is at first.
+ */
+void trace_set_level(uint8_t level);
+uint8_t trace_get_level(void);
+
+/**
+ * Writes one record. Anything past TRACE_ARGS_MAX arguments or TRACE_BLOB_MAX blob bytes is left
+ * off. blob is only written if it's nonzero.
+ */
+void trace_record(trace_event_t event, const uint32_t *args, uint32_t nargs,
+                  const void *blob, uint32_t blob_len);
+
+// (the leading 0 lets the argument list be empty)
+#define TRACE_ARGS(...) ((const uint32_t[]){ 0, ##__VA_ARGS__ } + 1)
+#define TRACE_NARGS(...) (sizeof((const uint32_t[]){ 0, ##__VA_ARGS__ }) / sizeof(uint32_t) - 1)
+
+/**
+ * TRACE(USB_RESET) or TRACE(EP2_OUT, bytes): an event with up to TRACE_ARGS_MAX scalar arguments.
+ * TRACE_BLOB(EP1_IN, buf, len, len) also carries len bytes from buf.
+ */
+#define TRACE(event, ...) \
+    trace_record(TRACE_##event, TRACE_ARGS(__VA_ARGS__), TRACE_NARGS(__VA_ARGS__), 0, 0)
+
+#define TRACE_BLOB(event, blob, blob_len, ...) \
+    trace_record(TRACE_##event, TRACE_ARGS(__VA_ARGS__), TRACE_NARGS(__VA_ARGS__), \
+                 (blob), (blob_len))
+
+#endif
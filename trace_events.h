@@ -0,0 +1,36 @@
+/**
+ * Every event the firmware can put in the trace, in ID order: TRACE_EVENT(name, level, format).
+ * This file is included by trace.h to number the events and by trace.c to look up their levels,
+ * and read by tools/mktracefmt.py at build time to give tools/tracedecode.py the matching format
+ * table, so events can only be appended or renamed here, never reordered, and nothing in it may
+ * be conditional.
+ *
+ * level is DEBUG, INFO or ERROR (see trace.h). In a format, {d} and {x} are the event's scalar
+ * arguments in decimal and hex, in the order they were passed, and {hex} is its blob as hex bytes
+ * or {str} its blob as text. An event has at most one blob placeholder, and it has to come last.
+ */
+TRACE_EVENT(BOOT,            INFO,  "boot")
+TRACE_EVENT(MEDIUM_REVERTED, INFO,  "medium reverted")
+TRACE_EVENT(UF2_COMPLETE,    INFO,  "UF2 complete, rebooting")
+TRACE_EVENT(USB_RESET,       INFO,  "USB reset")
+TRACE_EVENT(EP0_SETUP,       DEBUG, "got SETUP, {d} bytes: {hex}")
+TRACE_EVENT(EP0_STALL,       ERROR, "responding with STALL")
+TRACE_EVENT(EP0_OUT,         DEBUG, "TRCPT, {d} bytes: {hex}")
+TRACE_EVENT(EP1_HALT_CLEAR,  INFO,  "EP1 halt cleared, {d} bytes queued")
+TRACE_EVENT(EP1_IN,          DEBUG, "EP1 TX finished, {d} bytes: {hex}")
+TRACE_EVENT(EP1_STALL,       ERROR, "EP1 STALL sent")
+TRACE_EVENT(EP2_OUT,         DEBUG, "EP2 RX, {d} bytes")
+TRACE_EVENT(CBW,             DEBUG, "CBW tag {x} len {d} flags {x} lun {d} cb: {hex}")
+TRACE_EVENT(DROPPED,         ERROR, "{d} records dropped")
+TRACE_EVENT(MTB_CAPTURE,     INFO,  "MTB capture, {d} packets")
+TRACE_EVENT(MTB_PACKETS,     INFO,  "MTB {hex}")
+TRACE_EVENT(CONSOLE_COMMAND, ERROR, "> {str}")
+TRACE_EVENT(CONSOLE_UNKNOWN, ERROR, "unknown command, try help")
+TRACE_EVENT(CONSOLE_HELP,    ERROR, "stats | level [debug|info|error] | flush | cache ...")
+TRACE_EVENT(CONSOLE_IO,      ERROR, "read {d} kB, written {d} kB, {d} erases, overlay {d}/{d}")
+TRACE_EVENT(CONSOLE_IRQ,     ERROR, "{d} USB {d} DMAC irqs, {d} resets, {d} stalls, {d} dropped")
+TRACE_EVENT(CONSOLE_STACK,   ERROR, "stack {d} of {d} bytes used")
+TRACE_EVENT(CONSOLE_LEVEL,   ERROR, "trace level {d}")
+TRACE_EVENT(CONSOLE_FLUSH,   ERROR, "nothing to flush, every medium writes straight through")
+TRACE_EVENT(CONSOLE_CACHE,   ERROR, "flash read cache {d}")
+TRACE_EVENT(CONSOLE_HELP_2,  ERROR, "cache [on|off]: NVM flash read cache, not a sector cache")
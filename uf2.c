@@ -0,0 +1,113 @@
+#include "uf2.h"
+
+#include "nvm.h"
+#include "samd21.h"
+
+#include <string.h>
+
+typedef struct uf2
+{
+    const block_device_t *base;
+
+    // which blocks of the current file have already been programmed, and the last block seen
+    uint32_t num_blocks;
+    uint32_t blocks_written;
+    uint32_t last_block_no;
+    uint8_t written[(UF2_MAX_BLOCKS + 7) / 8];
+} uf2_t;
+
+static uf2_t uf2;
+
+static int uf2_read(const block_device_t *dev, uint32_t lba, uint8_t *buf)
+{
+    const uf2_t *u = dev->ctx;
+    return u->base->read(u->base, lba, buf);
+}
+
+/**
+ * Only 256 byte, row aligned payloads are accepted (which is what uf2conv produces for the samd21),
+ * so every block maps onto exactly one flash row.
+ */
+static int uf2_write(const block_device_t *dev, uint32_t lba, const uint8_t *buf)
+{
+    uf2_t *u = dev->ctx;
+    const uf2_block_t *b = (const uf2_block_t *)buf;
+
+    if ((b->magic_start0 != UF2_MAGIC_START0) || (b->magic_start1 != UF2_MAGIC_START1) ||
+        (b->magic_end != UF2_MAGIC_END)) {
+        return 0;
+    }
+
+    if ((b->flags & UF2_FLAG_NOT_MAIN_FLASH) ||
+        ((b->flags & UF2_FLAG_FAMILY_ID_PRESENT) && (b->family_id != UF2_FAMILY_ID_SAMD21)) ||
+        (b->payload_size != NVM_ROW_SIZE) || (b->target_addr & (NVM_ROW_SIZE - 1)) ||
+        (b->target_addr < UF2_APP_START) || (b->target_addr >= UF2_APP_END) ||
+        (b->num_blocks == 0) || (b->num_blocks > UF2_MAX_BLOCKS) ||
+        (b->block_no >= b->num_blocks)) {
+        return 0;
+    }
+
+    // A different file, or a file being copied over again: start counting again. A file the same
+    // size as the last one can only be told apart by block 0 turning up again after other blocks
+    // (a straight repeat of the sector just written is the host rewriting it).
+    if ((b->num_blocks != u->num_blocks) ||
+        ((b->block_no == 0) && (u->written[0] & 1) && (u->last_block_no != 0))) {
+        memset(u->written, 0, sizeof(u->written));
+        u->num_blocks = b->num_blocks;
+        u->blocks_written = 0;
+    }
+    u->last_block_no = b->block_no;
+
+    const uint8_t mask = 1 << (b->block_no & 7);
+    if (u->written[b->block_no >> 3] & mask) {
+        return 0;
+    }
+
+    if (nvm_erase_row(b->target_addr)) {
+        return 1;
+    }
+    for (uint32_t i = 0; i < NVM_ROW_SIZE; i += NVM_PAGE_SIZE) {
+        if (nvm_write_page(b->target_addr + i, &b->data[i])) {
+            return 1;
+        }
+    }
+
+    u->written[b->block_no >> 3] |= mask;
+    u->blocks_written++;
+    return 0;
+}
+
+int uf2_complete(void)
+{
+    return (uf2.num_blocks != 0) && (uf2.blocks_written == uf2.num_blocks);
+}
+
+void uf2_boot_app(void)
+{
+    const uint32_t *vectors = (const uint32_t *)UF2_APP_START;
+    const uint32_t sp = vectors[0];
+    const uint32_t pc = vectors[1];
+
+    // an erased row reads back as all 1s
+    if ((sp < HMCRAMC0_ADDR) || (sp > (HMCRAMC0_ADDR + HMCRAMC0_SIZE)) ||
+        (pc < UF2_APP_START) || (pc >= UF2_APP_END)) {
+        return;
+    }
+
+    SCB->VTOR = UF2_APP_START;
+    __set_MSP(sp);
+    ((void (*)(void))pc)();
+}
+
+void uf2_init(block_device_t *dev, const block_device_t *base)
+{
+    uf2.base = base;
+
+    *dev = (block_device_t) {
+        .ctx = &uf2,
+        .block_count = base->block_count,
+        .optimal_blocks = base->optimal_blocks,
+        .read = uf2_read,
+        .write = uf2_write,
+    };
+}
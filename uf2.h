@@ -0,0 +1,71 @@
+#ifndef UF2_H
+#define UF2_H
+
+#include "block_device.h"
+
+/**
+ * UF2 drag-and-drop flashing (https://github.com/microsoft/uf2). Any 512 byte block the host
+ * writes to any LBA is checked for the UF2 magic numbers; if it's a UF2 block, its payload is
+ * programmed into the application region of flash right away, so the file never needs to be
+ * buffered. Everything else the host writes (FAT and directory updates) is quietly dropped, and
+ * reads come from the base medium, which is expected to be a small generated volume.
+ *
+ * Blocks are tracked by block number, so they can arrive in any order and repeats are skipped.
+ * Once every block of the file has landed, uf2_complete() starts returning nonzero and the main
+ * loop reboots into the new application. A block with a different block count, or block 0 coming
+ * round again after other blocks, starts a new file, so copying a file over again (after an
+ * aborted copy, say) programs every block afresh.
+ *
+ * Programming happens inside the USB interrupt: each block is a row erase and four page writes,
+ * a few milliseconds of NVM busy time during which no other interrupt (trace DMA, console RX)
+ * gets serviced. That's acceptable for a bootloader that does nothing else while it's being
+ * flashed, but nothing else should sit on top of this medium expecting interrupts to be prompt.
+ */
+#ifndef UF2_APP_START
+#define UF2_APP_START 0x8000
+#endif
+
+#define UF2_APP_END 0x40000
+
+#define UF2_MAX_BLOCKS ((UF2_APP_END - UF2_APP_START) / 256)
+
+#define UF2_MAGIC_START0 0x0a324655
+#define UF2_MAGIC_START1 0x9e5d5157
+#define UF2_MAGIC_END 0x0ab16f30
+
+#define UF2_FLAG_NOT_MAIN_FLASH 0x00000001
+#define UF2_FLAG_FAMILY_ID_PRESENT 0x00002000
+
+#define UF2_FAMILY_ID_SAMD21 0x68ed2b88
+
+typedef struct uf2_block
+{
+    uint32_t magic_start0;
+    uint32_t magic_start1;
+    uint32_t flags;
+    uint32_t target_addr;
+    uint32_t payload_size;
+    uint32_t block_no;
+    uint32_t num_blocks;
+    uint32_t family_id;
+    uint8_t data[476];
+    uint32_t magic_end;
+} uf2_block_t;
+
+/**
+ * Fills in dev so that reads come from base and writes go to the UF2 engine.
+ */
+void uf2_init(block_device_t *dev, const block_device_t *base);
+
+/**
+ * Returns nonzero once every block of a UF2 file has been programmed.
+ */
+int uf2_complete(void);
+
+/**
+ * If there's something that looks like an application at UF2_APP_START, jumps to it and never
+ * returns.
+ */
+void uf2_boot_app(void);
+
+#endif
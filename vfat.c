@@ -0,0 +1,230 @@
+#include "vfat.h"
+
+#include <string.h>
+
+#define VFAT_RESERVED_SECTORS 1
+#define VFAT_NUM_FATS 2
+#define VFAT_ROOT_ENTRIES 512
+#define VFAT_ROOT_SECTORS ((VFAT_ROOT_ENTRIES * 32) / BLOCK_DEVICE_BLOCK_SIZE)
+#define VFAT_FAT_ENTRIES_PER_SECTOR (BLOCK_DEVICE_BLOCK_SIZE / 2)
+
+// 2019-01-01 00:00:00
+#define VFAT_DATE ((39 << 9) | (1 << 5) | 1)
+#define VFAT_TIME 0
+
+typedef struct vfat
+{
+    const vfat_file_t *files;
+    uint32_t nfiles;
+
+    // first cluster of each file, and one past the last cluster of the last file
+    uint16_t first_cluster[VFAT_MAX_FILES + 1];
+
+    uint32_t cluster_shift;
+    uint32_t fat_sectors;
+    uint32_t fat_start;
+    uint32_t root_start;
+    uint32_t data_start;
+} vfat_t;
+
+static vfat_t vfat;
+
+static void vfat_put16(uint8_t *p, uint16_t x)
+{
+    p[0] = x;
+    p[1] = x >> 8;
+}
+
+static void vfat_put32(uint8_t *p, uint32_t x)
+{
+    vfat_put16(&p[0], x);
+    vfat_put16(&p[2], x >> 16);
+}
+
+static void vfat_boot_sector(const block_device_t *dev, const vfat_t *v, uint8_t *buf)
+{
+    static const uint8_t head[] = {
+        0xeb, 0x3c, 0x90, 'M', 'S', 'D', 'O', 'S', '5', '.', '0'
+    };
+    static const uint8_t tail[] = {
+        'V', 'F', 'A', 'T', ' ', ' ', ' ', ' ', ' ', ' ', ' ',
+        'F', 'A', 'T', '1', '6', ' ', ' ', ' '
+    };
+
+    memcpy(buf, head, sizeof(head));
+    vfat_put16(&buf[11], BLOCK_DEVICE_BLOCK_SIZE);
+    buf[13] = 1 << v->cluster_shift;
+    vfat_put16(&buf[14], VFAT_RESERVED_SECTORS);
+    buf[16] = VFAT_NUM_FATS;
+    vfat_put16(&buf[17], VFAT_ROOT_ENTRIES);
+    if (dev->block_count < 0x10000) {
+        vfat_put16(&buf[19], dev->block_count);
+    } else {
+        vfat_put32(&buf[32], dev->block_count);
+    }
+    buf[21] = 0xf8;
+    vfat_put16(&buf[22], v->fat_sectors);
+    vfat_put16(&buf[24], 32);   // sectors per track
+    vfat_put16(&buf[26], 64);   // heads
+    buf[36] = 0x80;
+    buf[38] = 0x29;
+    vfat_put32(&buf[39], 0x56464154);
+    memcpy(&buf[43], tail, sizeof(tail));
+    buf[510] = 0x55;
+    buf[511] = 0xaa;
+}
+
+/**
+ * Every file is one contiguous cluster chain, so a FAT sector is just "next cluster" runs with an
+ * end-of-chain marker at the end of each file.
+ */
+static void vfat_fat_sector(const vfat_t *v, uint32_t sector, uint8_t *buf)
+{
+    const uint32_t first = sector * VFAT_FAT_ENTRIES_PER_SECTOR;
+    const uint32_t last = first + VFAT_FAT_ENTRIES_PER_SECTOR;
+
+    if (sector == 0) {
+        vfat_put16(&buf[0], 0xfff8);
+        vfat_put16(&buf[2], 0xffff);
+    }
+
+    for (uint32_t f = 0; f < v->nfiles; f++) {
+        uint32_t c = v->first_cluster[f];
+        const uint32_t end = v->first_cluster[f + 1];
+        if (c < first) {
+            c = first;
+        }
+        for (; (c < end) && (c < last); c++) {
+            vfat_put16(&buf[(c - first) * 2], (c == (end - 1)) ? 0xffff : (c + 1));
+        }
+    }
+}
+
+static void vfat_root_sector(const vfat_t *v, uint8_t *buf)
+{
+    static const char label[11] = { 'V', 'F', 'A', 'T', ' ', ' ', ' ', ' ', ' ', ' ', ' ' };
+
+    memcpy(buf, label, sizeof(label));
+    buf[11] = 0x08;
+
+    for (uint32_t f = 0; f < v->nfiles; f++) {
+        uint8_t *e = &buf[(f + 1) * 32];
+        memcpy(e, v->files[f].name, 11);
+        e[11] = 0x01;   // read only
+        vfat_put16(&e[14], VFAT_TIME);
+        vfat_put16(&e[16], VFAT_DATE);
+        vfat_put16(&e[18], VFAT_DATE);
+        vfat_put16(&e[22], VFAT_TIME);
+        vfat_put16(&e[24], VFAT_DATE);
+        vfat_put16(&e[26], v->files[f].size ? v->first_cluster[f] : 0);
+        vfat_put32(&e[28], v->files[f].size);
+    }
+}
+
+static void vfat_data_sector(const vfat_t *v, uint32_t sector, uint8_t *buf)
+{
+    const uint32_t cluster = (sector >> v->cluster_shift) + 2;
+
+    for (uint32_t f = 0; f < v->nfiles; f++) {
+        if ((cluster >= v->first_cluster[f]) && (cluster < v->first_cluster[f + 1])) {
+            const vfat_file_t *file = &v->files[f];
+            const uint32_t offset = (sector - ((v->first_cluster[f] - 2) << v->cluster_shift))
+                                    << BLOCK_DEVICE_BLOCK_SHIFT;
+            if (offset >= file->size) {
+                return;
+            }
+
+            if (file->read) {
+                file->read(file, offset, buf);
+                uint32_t len = file->size - offset;
+                if (len < BLOCK_DEVICE_BLOCK_SIZE) {
+                    memset(&buf[len], 0, BLOCK_DEVICE_BLOCK_SIZE - len);
+                }
+            } else {
+                uint32_t len = file->size - offset;
+                if (len > BLOCK_DEVICE_BLOCK_SIZE) {
+                    len = BLOCK_DEVICE_BLOCK_SIZE;
+                }
+                memcpy(buf, &file->data[offset], len);
+            }
+            return;
+        }
+    }
+}
+
+static int vfat_read(const block_device_t *dev, uint32_t lba, uint8_t *buf)
+{
+    const vfat_t *v = dev->ctx;
+
+    memset(buf, 0, BLOCK_DEVICE_BLOCK_SIZE);
+    if (lba == 0) {
+        vfat_boot_sector(dev, v, buf);
+    } else if (lba < v->root_start) {
+        uint32_t sector = lba - v->fat_start;
+        if (sector >= v->fat_sectors) {
+            sector -= v->fat_sectors;
+        }
+        vfat_fat_sector(v, sector, buf);
+    } else if (lba == v->root_start) {
+        vfat_root_sector(v, buf);
+    } else if (lba >= v->data_start) {
+        vfat_data_sector(v, lba - v->data_start, buf);
+    }
+    return 0;
+}
+
+int vfat_init(block_device_t *dev, const vfat_file_t *files, uint32_t nfiles,
+              uint32_t block_count)
+{
+    vfat_t *v = &vfat;
+
+    if ((block_count < VFAT_MIN_BLOCKS) || (block_count > VFAT_MAX_BLOCKS)) {
+        *dev = (block_device_t) { 0 };
+        return 1;
+    }
+
+    if (nfiles > VFAT_MAX_FILES) {
+        nfiles = VFAT_MAX_FILES;
+    }
+    v->files = files;
+    v->nfiles = nfiles;
+
+    // Use the smallest clusters that keep the cluster count inside FAT16's range. The FAT size
+    // depends on the cluster count and vice versa; sizing the FAT for the whole volume errs on
+    // the big side by a sector or two.
+    uint32_t clusters;
+    for (v->cluster_shift = 0; ; v->cluster_shift++) {
+        const uint32_t approx = block_count >> v->cluster_shift;
+        v->fat_sectors =
+            (((approx + 2) * 2) + BLOCK_DEVICE_BLOCK_SIZE - 1) >> BLOCK_DEVICE_BLOCK_SHIFT;
+        v->fat_start = VFAT_RESERVED_SECTORS;
+        v->root_start = v->fat_start + VFAT_NUM_FATS * v->fat_sectors;
+        v->data_start = v->root_start + VFAT_ROOT_SECTORS;
+        clusters = (block_count - v->data_start) >> v->cluster_shift;
+        if ((clusters <= VFAT_MAX_CLUSTERS) || (v->cluster_shift == VFAT_MAX_CLUSTER_SHIFT)) {
+            break;
+        }
+    }
+
+    // files that don't fit on the volume get dropped.
+    uint32_t next = 2;
+    const uint32_t cluster_bytes_shift = BLOCK_DEVICE_BLOCK_SHIFT + v->cluster_shift;
+    for (uint32_t f = 0; f < nfiles; f++) {
+        const uint32_t n = (files[f].size + (1 << cluster_bytes_shift) - 1) >> cluster_bytes_shift;
+        if ((next + n) > (clusters + 2)) {
+            v->nfiles = f;
+            break;
+        }
+        v->first_cluster[f] = next;
+        next += n;
+    }
+    v->first_cluster[v->nfiles] = next;
+
+    *dev = (block_device_t) {
+        .ctx = v,
+        .block_count = block_count,
+        .optimal_blocks = 1 << v->cluster_shift,
+        .read = vfat_read,
+    };
+    return 0;
+}
@@ -0,0 +1,59 @@
+#ifndef VFAT_H
+#define VFAT_H
+
+#include "block_device.h"
+
+/**
+ * A FAT16 volume that doesn't exist anywhere. The boot sector, FATs, root directory and file
+ * contents are all computed when the host asks for them from a small table of files, so the
+ * capacity reported to the host has nothing to do with how much memory we have.
+ *
+ * Files are laid out back to back starting at the first data cluster, and their sizes are fixed
+ * when the volume is created; the host caches directory entries, so a file can't grow behind its
+ * back.
+ */
+typedef struct vfat_file vfat_file_t;
+
+struct vfat_file
+{
+    // 8.3 name in directory entry form: space padded, no dot. e.g. "STATUS  TXT"
+    char name[11];
+    uint32_t size;
+
+    // Contents come from either data (if read is 0) or read. read fills in the block of the file
+    // which starts at byte offset; buf is zeroed beforehand, and anything past the end of the file
+    // is ignored.
+    const uint8_t *data;
+    void (*read)(const vfat_file_t *file, uint32_t offset, uint8_t *buf);
+};
+
+#define VFAT_MAX_FILES 15
+
+/**
+ * Hosts decide between FAT12 and FAT16 by the cluster count alone, so a FAT16 volume needs at
+ * least 4085 clusters. With one block per cluster that's the boot sector, two 17 sector FATs and
+ * the 32 sector root directory on top of 4085 data blocks.
+ */
+#define VFAT_MIN_CLUSTERS 4085
+#define VFAT_MIN_BLOCKS 4152
+
+/**
+ * And under 65525 clusters. Clusters go up to 64 blocks (32 KiB, the most every host takes), and
+ * at that size this is the biggest volume whose clusters and FATs still fit: about 2 GiB.
+ */
+#define VFAT_MAX_CLUSTERS 65524
+#define VFAT_MAX_CLUSTER_SHIFT 6
+#define VFAT_MAX_BLOCKS 4194144
+
+/**
+ * Fills in dev with a read-only volume of block_count blocks that holds files[0..nfiles). files
+ * has to stay around for as long as dev does. nfiles is clamped to VFAT_MAX_FILES so that the
+ * directory fits in one sector next to the volume label.
+ *
+ * Returns nonzero, and leaves dev as an empty medium, if block_count is outside VFAT_MIN_BLOCKS to
+ * VFAT_MAX_BLOCKS.
+ */
+int vfat_init(block_device_t *dev, const vfat_file_t *files, uint32_t nfiles,
+              uint32_t block_count);
+
+#endif